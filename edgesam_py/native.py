@@ -0,0 +1,258 @@
+"""EdgeSAM segmentation on the C++ engine.
+
+The ``_edgesam`` extension module is built from ``src/pythonBindings.cpp`` with
+``make build-native``. Images and masks are passed without copies, the encoder
+and decoder release the GIL, and embeddings are kept so that several prompts on
+one image only run the decoder.
+"""
+
+from __future__ import annotations
+
+from pathlib import Path
+from typing import TYPE_CHECKING, Any
+
+import cv2
+import numpy as np
+
+from edgesam_py.segmentation import save_overlay
+
+
+if TYPE_CHECKING:
+    from numpy.typing import NDArray
+
+
+try:
+    from edgesam_py import _edgesam
+except ImportError:  # pragma: no cover - depends on the native build
+    _edgesam = None
+
+
+# ONNX Runtime provider names to the device types of Sam::Parameter
+_DEVICE_TYPES = {
+    "CPUExecutionProvider": 0,
+    "CUDAExecutionProvider": 1,
+    "TensorrtExecutionProvider": 2,
+    "XnnpackExecutionProvider": 3,
+    "CoreMLExecutionProvider": 4,
+}
+
+
+def native_available() -> bool:
+    """Return whether the ``_edgesam`` extension module is built."""
+    return _edgesam is not None
+
+
+def _split_prompt(
+    point_coords: NDArray[np.float32] | None,
+    point_labels: NDArray[np.float32] | None,
+) -> tuple[list[Any], list[Any], tuple[float, ...] | None]:
+    """Split SAM style points and labels into positive points, negative points and a box.
+
+    Labels are 1 for positive points, 0 for negative points and 2 / 3 for the top left /
+    bottom right box corners; other labels (padding) are ignored.
+    """
+    positive: list[Any] = []
+    negative: list[Any] = []
+    corners: dict[int, Any] = {}
+    if point_coords is None:
+        return positive, negative, None
+    coords = np.asarray(point_coords, dtype=np.float32).reshape(-1, 2)
+    labels = (
+        np.ones(len(coords), dtype=np.float32)
+        if point_labels is None
+        else np.asarray(point_labels, dtype=np.float32).reshape(-1)
+    )
+    for point, label in zip(coords, labels):
+        if label == 1:
+            positive.append(point)
+        elif label == 0:
+            negative.append(point)
+        elif label in (2, 3):
+            corners[int(label)] = point
+    box = None
+    if len(corners) == 2:  # noqa: PLR2004
+        box = (*corners[2], *corners[3])
+    return positive, negative, box
+
+
+class NativeSegmenter:
+    """EdgeSAM segmentation on the C++ ``Sam`` engine.
+
+    A drop-in replacement of ``EdgeSAMSegmenter.segment`` / ``save_result``, with
+    ``set_image`` and ``predict`` to decode several prompts on one embedding.
+
+    Attributes:
+        encoder_path: Path to the encoder ONNX model.
+        decoder_path: Path to the decoder ONNX model.
+        providers: ONNX Runtime execution providers.
+    """
+
+    def __init__(
+        self,
+        encoder_path: str | Path,
+        decoder_path: str | Path,
+        providers: list[str] | None = None,
+        threads: int = 1,
+        embedding_cache_bytes: int = 0,
+        collect_metrics: bool = False,
+        embedding_storage: str = "float32",
+    ) -> None:
+        """Initialize the segmenter.
+
+        Args:
+            encoder_path: Path to the encoder ONNX model file.
+            decoder_path: Path to the decoder ONNX model file.
+            providers: ONNX Runtime execution providers, the first one is used.
+                Defaults to ['CPUExecutionProvider'].
+            threads: Intra-op threads of each session.
+            embedding_cache_bytes: Size of the embedding cache, 0 disables it.
+            collect_metrics: Count stage timings, read with ``sam.metrics()``.
+            embedding_storage: ``"float32"``, or ``"float16"`` / ``"int8"`` to keep
+                embeddings (and the cache) in half / a quarter of the memory.
+
+        Raises:
+            ImportError: If the native module is not built.
+            FileNotFoundError: If model files don't exist.
+            ValueError: If the provider is not supported.
+            RuntimeError: If the models cannot be loaded.
+        """
+        if _edgesam is None:
+            msg = "edgesam_py._edgesam is not built, run `make build-native`"
+            raise ImportError(msg)
+
+        self.encoder_path = Path(encoder_path)
+        self.decoder_path = Path(decoder_path)
+
+        if not self.encoder_path.exists():
+            msg = f"Encoder model not found: {self.encoder_path}"
+            raise FileNotFoundError(msg)
+
+        if not self.decoder_path.exists():
+            msg = f"Decoder model not found: {self.decoder_path}"
+            raise FileNotFoundError(msg)
+
+        if providers is None:
+            providers = ["CPUExecutionProvider"]
+        if providers[0] not in _DEVICE_TYPES:
+            msg = f"Unsupported provider: {providers[0]}"
+            raise ValueError(msg)
+
+        self.providers = providers
+        device = _DEVICE_TYPES[providers[0]]
+        self.sam = _edgesam.Sam(
+            str(self.encoder_path),
+            str(self.decoder_path),
+            threads=threads,
+            encoder_device=device,
+            decoder_device=device,
+            embedding_cache_bytes=embedding_cache_bytes,
+            collect_metrics=collect_metrics,
+            embedding_storage=embedding_storage,
+        )
+        if not self.sam.is_loaded:
+            msg = f"Sam initialization failed: {self.sam.load_status}"
+            raise RuntimeError(msg)
+        self._embedding: Any = None
+
+    def set_image(self, image: NDArray[np.uint8]) -> Any:
+        """Encode an image, later ``predict`` calls decode on its embedding.
+
+        Args:
+            image: BGR image as returned by cv2.imread.
+
+        Returns:
+            The embedding of the image.
+        """
+        embedding = self.sam.encode(np.ascontiguousarray(image))
+        self._embedding = embedding
+        return embedding
+
+    def predict(
+        self,
+        point_coords: NDArray[np.float32] | None = None,
+        point_labels: NDArray[np.float32] | None = None,
+        embedding: Any = None,
+    ) -> tuple[NDArray[np.float32], float]:
+        """Decode a prompt on the embedding of the last ``set_image`` call.
+
+        Args:
+            point_coords: Point coordinates in image pixels.
+            point_labels: SAM point labels (1 positive, 0 negative, 2 / 3 box corners).
+            embedding: Embedding to decode on instead of the last one.
+
+        Returns:
+            Tuple of (mask probabilities at image size, predicted IoU).
+        """
+        if embedding is None:
+            embedding = self._embedding
+        if embedding is None:
+            msg = "No image set, call set_image first"
+            raise RuntimeError(msg)
+        positive, negative, box = _split_prompt(point_coords, point_labels)
+        mask, iou, _ = self.sam.get_mask(
+            points=positive,
+            negative_points=negative,
+            box=box,
+            embedding=embedding,
+            output="probability",
+        )
+        return mask, iou
+
+    def segment(
+        self,
+        image_path: str | Path,
+        point_coords: NDArray[np.float32] | None = None,
+        point_labels: NDArray[np.float32] | None = None,
+    ) -> tuple[NDArray[np.uint8], NDArray[np.float32]]:
+        """Segment an image.
+
+        Args:
+            image_path: Path to input image.
+            point_coords: Optional point coordinates for prompting.
+            point_labels: Optional point labels.
+
+        Returns:
+            Tuple of (original image, mask probabilities).
+
+        Raises:
+            FileNotFoundError: If image file doesn't exist.
+        """
+        image_path = Path(image_path)
+        if not image_path.exists():
+            msg = f"Image not found: {image_path}"
+            raise FileNotFoundError(msg)
+
+        image = cv2.imread(str(image_path))
+        if image is None:
+            msg = f"Failed to read image: {image_path}"
+            raise RuntimeError(msg)
+
+        self.set_image(image)
+        mask, _ = self.predict(point_coords, point_labels)
+        return image, mask
+
+    def save_result(
+        self,
+        image: NDArray[np.uint8],
+        mask: NDArray[np.float32],
+        output_path: str | Path,
+        threshold: float = 0.5,
+    ) -> None:
+        """Save segmentation result.
+
+        Args:
+            image: Original image.
+            mask: Segmentation mask.
+            output_path: Path to save the result.
+            threshold: Threshold for binary mask.
+        """
+        save_overlay(image, mask, output_path, threshold)
+
+    def __repr__(self) -> str:
+        """Return string representation."""
+        return (
+            f"NativeSegmenter("
+            f"encoder={self.encoder_path.name}, "
+            f"decoder={self.decoder_path.name}, "
+            f"providers={self.providers})"
+        )
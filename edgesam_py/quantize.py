@@ -0,0 +1,213 @@
+"""Produce fp16 and int8 (QDQ) variants of the EdgeSAM ONNX models.
+
+The C++ library detects the variant from the element types of the model inputs and outputs:
+fp16 models converted without ``keep_io_types`` take and return fp16 tensors, int8 QDQ models
+keep float inputs and outputs. int8 QDQ models are produced by static quantization, from
+``--calibration-images`` for the encoder. The decoder's prompt inputs cannot be built from images,
+so decoders are rejected in static mode. ``--dynamic`` opts into dynamic quantization instead
+(any model): its ConvInteger / MatMulInteger / DynamicQuantizeLinear nodes only run on the CPU,
+CUDA and TensorRT fall back to it.
+"""
+
+from __future__ import annotations
+
+import argparse
+import sys
+from pathlib import Path
+from typing import TYPE_CHECKING
+
+
+if TYPE_CHECKING:
+    from collections.abc import Iterable, Iterator
+
+    import numpy as np
+    from numpy.typing import NDArray
+
+
+IMAGE_SUFFIXES = (".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".webp")
+
+
+def convert_fp16(
+    model_path: str | Path,
+    output_path: str | Path,
+    keep_io_types: bool = False,
+) -> Path:
+    """Convert a float32 model to float16.
+
+    Args:
+        model_path: Input ONNX model.
+        output_path: Where to write the converted model.
+        keep_io_types: Keep float32 inputs and outputs (casts are inserted in the graph).
+
+    Returns:
+        Path of the converted model.
+    """
+    import onnx
+    from onnxconverter_common import float16
+
+    model = onnx.load(str(model_path))
+    converted = float16.convert_float_to_float16(model, keep_io_types=keep_io_types)
+    onnx.save(converted, str(output_path))
+    return Path(output_path)
+
+
+class _FeedReader:
+    """Calibration data reader over a sequence of input feeds."""
+
+    def __init__(self, feeds: Iterable[dict[str, NDArray[np.float32]]]) -> None:
+        self._feeds = iter(feeds)
+
+    def get_next(self) -> dict[str, NDArray[np.float32]] | None:
+        return next(self._feeds, None)
+
+
+def image_feeds(
+    model_path: str | Path,
+    images: Iterable[str | Path],
+) -> Iterator[dict[str, NDArray[np.float32]]]:
+    """Preprocess images into encoder feeds, the way EdgeSAMSegmenter.preprocess_image does.
+
+    Images are resized to the model input size (1024 x 1024 when dynamic), converted to RGB,
+    scaled to [0, 1] and transposed to NCHW.
+
+    Args:
+        model_path: Encoder ONNX model, provides the input name and size.
+        images: Image files; directories are expanded to the images they contain.
+
+    Yields:
+        One input name -> array feed per readable image.
+
+    Raises:
+        ValueError: If the model takes more than one input (a decoder), or an image cannot be
+            read.
+    """
+    import cv2
+    import numpy as np
+    import onnx
+
+    model = onnx.load(str(model_path), load_external_data=False)
+    initializers = {init.name for init in model.graph.initializer}
+    inputs = [inp for inp in model.graph.input if inp.name not in initializers]
+    if len(inputs) != 1:
+        msg = (
+            f"{model_path} takes {len(inputs)} inputs; calibration images only feed encoders, "
+            "quantize decoders with --dynamic or keep them float"
+        )
+        raise ValueError(msg)
+    model_input = inputs[0]
+    dims = [d.dim_value for d in model_input.type.tensor_type.shape.dim]
+    height, width = (dims[2] or 1024, dims[3] or 1024) if len(dims) == 4 else (1024, 1024)
+
+    for image_path in map(Path, images):
+        files = (
+            sorted(p for p in image_path.iterdir() if p.suffix.lower() in IMAGE_SUFFIXES)
+            if image_path.is_dir()
+            else [image_path]
+        )
+        for file in files:
+            image = cv2.imread(str(file))
+            if image is None:
+                raise ValueError(f"Cannot read calibration image {file}")
+            resized = cv2.resize(image, (width, height), interpolation=cv2.INTER_LINEAR)
+            rgb = cv2.cvtColor(resized, cv2.COLOR_BGR2RGB).astype(np.float32) / 255.0
+            yield {model_input.name: np.transpose(rgb, (2, 0, 1))[np.newaxis, ...]}
+
+
+def quantize_int8(
+    model_path: str | Path,
+    output_path: str | Path,
+    calibration_feeds: Iterable[dict[str, NDArray[np.float32]]] | None = None,
+    dynamic: bool = False,
+) -> Path:
+    """Quantize a float32 model to int8.
+
+    With calibration feeds (input name -> array, e.g. preprocessed images for the encoder) the
+    model is statically quantized in QDQ format. Dynamic quantization must be requested: its
+    integer ops only run on the CPU execution provider.
+
+    Args:
+        model_path: Input ONNX model.
+        output_path: Where to write the quantized model.
+        calibration_feeds: Representative model inputs, required unless dynamic.
+        dynamic: Quantize weights dynamically instead, without calibration.
+
+    Returns:
+        Path of the quantized model.
+
+    Raises:
+        ValueError: If neither calibration feeds nor dynamic are given, or both are.
+    """
+    from onnxruntime.quantization import QuantFormat, QuantType, quantize_dynamic, quantize_static
+
+    if dynamic == (calibration_feeds is not None):
+        msg = "int8 quantization takes either calibration feeds (QDQ) or dynamic=True"
+        raise ValueError(msg)
+    if dynamic:
+        quantize_dynamic(str(model_path), str(output_path), weight_type=QuantType.QInt8)
+    else:
+        quantize_static(
+            str(model_path),
+            str(output_path),
+            _FeedReader(calibration_feeds),
+            quant_format=QuantFormat.QDQ,
+            activation_type=QuantType.QInt8,
+            weight_type=QuantType.QInt8,
+        )
+    return Path(output_path)
+
+
+def main() -> int:
+    """Command-line entry point.
+
+    Returns:
+        Exit code.
+    """
+    parser = argparse.ArgumentParser(description="Create fp16 / int8 EdgeSAM model variants")
+    parser.add_argument("model", type=Path, help="float32 ONNX model")
+    parser.add_argument("output", type=Path, help="output ONNX model")
+    parser.add_argument("--mode", choices=["fp16", "int8"], default="fp16")
+    parser.add_argument(
+        "--keep-io-types",
+        action="store_true",
+        help="fp16: keep float32 inputs and outputs",
+    )
+    parser.add_argument(
+        "--calibration-images",
+        type=Path,
+        nargs="+",
+        metavar="PATH",
+        help="int8: images or image directories for static QDQ quantization of an encoder",
+    )
+    parser.add_argument(
+        "--dynamic",
+        action="store_true",
+        help="int8: quantize dynamically instead (CPU only integer ops, no calibration)",
+    )
+    args = parser.parse_args()
+    if (args.calibration_images or args.dynamic) and args.mode != "int8":
+        parser.error("--calibration-images and --dynamic require --mode int8")
+    if args.mode == "int8" and bool(args.calibration_images) == args.dynamic:
+        parser.error("--mode int8 takes either --calibration-images or --dynamic")
+
+    if not args.model.exists():
+        print(f"Error: model not found: {args.model}", file=sys.stderr)  # noqa: T201
+        return 1
+    if args.mode == "fp16":
+        convert_fp16(args.model, args.output, keep_io_types=args.keep_io_types)
+    else:
+        feeds = None
+        if args.calibration_images:
+            try:
+                feeds = list(image_feeds(args.model, args.calibration_images))
+            except ValueError as e:
+                print(f"Error: {e}", file=sys.stderr)  # noqa: T201
+                return 1
+            if not feeds:
+                print("Error: no calibration images found", file=sys.stderr)  # noqa: T201
+                return 1
+        quantize_int8(args.model, args.output, feeds, dynamic=args.dynamic)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
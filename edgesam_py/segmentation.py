@@ -14,6 +14,32 @@ if TYPE_CHECKING:
     from numpy.typing import NDArray
 
 
+def save_overlay(
+    image: NDArray[np.uint8],
+    mask: NDArray[Any],
+    output_path: str | Path,
+    threshold: float = 0.5,
+) -> None:
+    """Save the image with the masked pixels tinted green.
+
+    Args:
+        image: Original BGR image.
+        mask: Segmentation mask of the image size.
+        output_path: Path to save the result.
+        threshold: Threshold for binary mask.
+    """
+    # Blend the masked pixels 30% towards green; the others are unchanged, so only one copy
+    # of the image and one of the masked pixels are made
+    foreground = mask > threshold
+    result = image.copy()
+    blended = image[foreground].astype(np.float32) * 0.7
+    blended[:, 1] += 255 * 0.3
+    result[foreground] = np.clip(np.rint(blended), 0, 255).astype(np.uint8)
+
+    # Save result
+    cv2.imwrite(str(output_path), result)
+
+
 class EdgeSAMSegmenter:
     """High-performance image segmentation using EdgeSAM model.
 
@@ -256,18 +282,7 @@ class EdgeSAMSegmenter:
             output_path: Path to save the result.
             threshold: Threshold for binary mask.
         """
-        # Apply threshold to create binary mask
-        binary_mask = (mask > threshold).astype(np.uint8) * 255
-
-        # Create colored overlay
-        overlay = image.copy()
-        overlay[binary_mask > 0] = [0, 255, 0]  # Green overlay
-
-        # Blend original and overlay
-        result = cv2.addWeighted(image, 0.7, overlay, 0.3, 0)
-
-        # Save result
-        cv2.imwrite(str(output_path), result)
+        save_overlay(image, mask, output_path, threshold)
 
     def __repr__(self) -> str:
         """Return string representation."""
@@ -0,0 +1,153 @@
+#include "automaticMaskGenerator.h"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <opencv2/imgproc.hpp>
+#include "preprocess.h"
+
+namespace {
+
+struct Candidate {
+    cv::Mat logits, mask;  // low resolution logits and their binary mask
+    cv::Rect box;  // of mask
+    int area{0};
+    double predictedIou{0}, stabilityScore{0};
+    cv::Point point;
+};
+
+// SAM's stability score: IoU between the masks thresholded at +offset and -offset
+double stabilityScore(const cv::Mat& logits, float threshold, float offset) {
+    const int intersections = cv::countNonZero(logits > threshold + offset);
+    const int unions = cv::countNonZero(logits > threshold - offset);
+    return unions > 0 ? (double)intersections / unions : 0.0;
+}
+
+double maskIou(const Candidate& a, const Candidate& b) {
+    const cv::Rect overlap = a.box & b.box;
+    if (overlap.empty()) return 0.0;
+    const int intersection = cv::countNonZero(a.mask(overlap) & b.mask(overlap));
+    return (double)intersection / (a.area + b.area - intersection);
+}
+
+}  // namespace
+
+AutomaticMaskGenerator::AutomaticMaskGenerator(Sam& sam) : m_sam(sam) {}
+AutomaticMaskGenerator::AutomaticMaskGenerator(Sam& sam, const Parameter& param)
+    : m_sam(sam), m_param(param) {}
+
+std::vector<AutomaticMaskGenerator::Result> AutomaticMaskGenerator::generate(
+    const cv::Mat& image) {
+    auto embedding = m_sam.encode(image);
+    if (!embedding) return {};
+    return generate(embedding);
+}
+
+std::vector<AutomaticMaskGenerator::Result> AutomaticMaskGenerator::generate(
+    const Sam::EmbeddingHandle& embedding) const {
+    if (!embedding || m_param.pointsPerSide <= 0) return {};
+    const cv::Size imageSize = embedding->transform.sourceSize;
+
+    std::vector<Sam::Prompt> prompts;
+    prompts.reserve(m_param.pointsPerSide * m_param.pointsPerSide);
+    for (int i = 0; i < m_param.pointsPerSide; i++) {
+        for (int j = 0; j < m_param.pointsPerSide; j++) {
+            Sam::Prompt prompt;
+            prompt.points.emplace_back(
+                (int)((j + 0.5) * imageSize.width / m_param.pointsPerSide),
+                (int)((i + 0.5) * imageSize.height / m_param.pointsPerSide));
+            prompts.push_back(std::move(prompt));
+        }
+    }
+
+    // decode in batches, filtering every mask candidate of each batch in parallel while its
+    // logits are still around; small masks go before NMS so they cannot suppress larger ones
+    std::vector<Candidate> candidates;
+    std::vector<char> accepted;
+    const size_t batchSize = std::max(m_param.pointsPerBatch, 1);
+    for (size_t first = 0; first < prompts.size(); first += batchSize) {
+        const size_t count = std::min(batchSize, prompts.size() - first);
+        std::vector<Sam::Prompt> batch(prompts.begin() + first, prompts.begin() + first + count);
+        std::vector<std::vector<cv::Mat>> logits;
+        std::vector<std::vector<double>> ious;
+        if (!m_sam.getLowResMaskCandidates(embedding, batch, logits, ious)) return {};
+
+        const size_t perPrompt = logits.empty() ? 0 : logits[0].size();
+        const size_t offset = candidates.size();
+        // minMaskArea is compared with the low resolution area of the image part of the mask,
+        // scaled by the source pixels one low resolution pixel covers
+        cv::Rect crop;
+        double sourcePixels = 0;
+        if (perPrompt > 0) {
+            crop = lowResCrop(logits[0][0].size(), embedding->transform);
+            sourcePixels = (double)embedding->transform.sourceSize.area() / crop.area();
+        }
+        candidates.resize(offset + count * perPrompt);
+        accepted.resize(candidates.size(), 0);
+        cv::parallel_for_(cv::Range(0, (int)(count * perPrompt)), [&](const cv::Range& range) {
+            for (int k = range.start; k < range.end; k++) {
+                const size_t i = k / perPrompt, c = k % perPrompt;
+                const cv::Mat& candidateLogits = logits[i][c];
+                auto& candidate = candidates[offset + k];
+                candidate.predictedIou = ious[i][c];
+                if (candidate.predictedIou < m_param.predIouThresh) continue;
+
+                candidate.stabilityScore = stabilityScore(candidateLogits, m_param.maskThreshold,
+                                                          m_param.stabilityScoreOffset);
+                if (candidate.stabilityScore < m_param.stabilityScoreThresh) continue;
+
+                candidate.mask = candidateLogits > m_param.maskThreshold;
+                candidate.area = cv::countNonZero(candidate.mask);
+                if (candidate.area == 0) continue;
+                if (m_param.minMaskArea > 0 &&
+                    cv::countNonZero(candidate.mask(crop)) * sourcePixels < m_param.minMaskArea) {
+                    continue;
+                }
+                candidate.logits = candidateLogits;
+                candidate.box = maskBoundingBox(candidate.mask);
+                candidate.point = prompts[first + i].points.front();
+                accepted[offset + k] = 1;
+            }
+        });
+    }
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (accepted[i]) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return candidates[a].predictedIou > candidates[b].predictedIou;
+    });
+
+    // greedy mask NMS, bounding boxes reject most pairs before any pixel is touched
+    std::vector<size_t> kept;
+    for (auto i : order) {
+        bool duplicate = false;
+        for (auto k : kept) {
+            if (maskIou(candidates[i], candidates[k]) > m_param.nmsThresh) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate) kept.push_back(i);
+    }
+
+    std::vector<Result> results(kept.size());
+    cv::parallel_for_(cv::Range(0, (int)kept.size()), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            const auto& candidate = candidates[kept[i]];
+            const cv::Mat mask =
+                m_sam.upscaleMask(embedding, candidate.logits, m_param.maskThreshold);
+
+            auto& result = results[i];
+            result.area = cv::countNonZero(mask);
+            result.box = maskBoundingBox(mask);
+            result.predictedIou = candidate.predictedIou;
+            result.stabilityScore = candidate.stabilityScore;
+            result.point = candidate.point;
+            if (m_param.outputRle) {
+                result.rle = encodeRle(mask);
+            }
+        }
+    });
+    return results;
+}
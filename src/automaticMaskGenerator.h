@@ -0,0 +1,44 @@
+#ifndef SAMCPP__AUTOMATIC_MASK_GENERATOR_H_
+#define SAMCPP__AUTOMATIC_MASK_GENERATOR_H_
+
+#include <vector>
+#include "edgeSam.h"
+#include "maskUtils.h"
+
+// "Segment everything": prompts Sam with a regular point grid over the image and keeps the
+// distinct, confident masks among all the candidates of every point
+class AutomaticMaskGenerator {
+public:
+    struct Parameter {
+        int pointsPerSide{32};    // grid of pointsPerSide x pointsPerSide prompts
+        int pointsPerBatch{64};   // prompts per Sam::getLowResMaskCandidates call
+        float predIouThresh{0.88f};
+        float stabilityScoreThresh{0.95f};
+        float stabilityScoreOffset{1.0f};
+        float maskThreshold{0.0f};  // logit threshold of the binary mask
+        float nmsThresh{0.7f};      // mask IoU above which the lower scored mask is dropped
+        // in source image pixels, estimated from the low resolution mask before NMS
+        int minMaskArea{0};
+        bool outputRle{true};
+    };
+
+    struct Result {
+        cv::Rect box;  // in source image coordinates, like rle
+        int area{0};
+        double predictedIou{0}, stabilityScore{0};
+        cv::Point point;  // grid point that produced the mask
+        RleMask rle;      // empty unless Parameter::outputRle
+    };
+
+    AutomaticMaskGenerator(Sam& sam);
+    AutomaticMaskGenerator(Sam& sam, const Parameter& param);
+
+    std::vector<Result> generate(const cv::Mat& image);
+    std::vector<Result> generate(const Sam::EmbeddingHandle& embedding) const;
+
+private:
+    Sam& m_sam;
+    Parameter m_param;
+};
+
+#endif  // SAMCPP__AUTOMATIC_MASK_GENERATOR_H_
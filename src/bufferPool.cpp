@@ -0,0 +1,157 @@
+#include "bufferPool.h"
+#include <algorithm>
+
+static const size_t kMinBytes = 4096;
+
+// Class 0 is 4 KB, then four classes per power of two: 2^k * (1 + i / 4), i = 1 - 4
+static size_t classSize(int index) {
+    if (index == 0) return kMinBytes;
+    const size_t base = size_t(1) << (12 + (index - 1) / 4);
+    return base + ((index - 1) % 4 + 1) * (base / 4);
+}
+
+// Class of a request and its size. Returns -1 past the largest class, those buffers are not
+// pooled.
+static int sizeClass(size_t bytes, size_t& classBytes) {
+    if (bytes <= kMinBytes) {
+        classBytes = kMinBytes;
+        return 0;
+    }
+    int k = 12;  // 2^k < bytes <= 2^(k + 1)
+    while ((size_t(2) << k) < bytes) k++;
+    const size_t base = size_t(1) << k, step = base / 4;
+    const size_t sub = (bytes - base + step - 1) / step;  // 1 - 4
+    classBytes = base + sub * step;
+    const int index = (k - 12) * 4 + (int)sub;
+    return index < BufferPool::kClasses ? index : -1;
+}
+
+BufferPool& BufferPool::shared() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+void* BufferPool::acquire(size_t bytes) {
+    size_t classBytes;
+    const int index = sizeClass(bytes, classBytes);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inUse += classBytes;
+        if (index >= 0 && !m_free[index].empty()) {
+            void* p = m_free[index].back();
+            m_free[index].pop_back();
+            m_cached -= classBytes;
+            m_hits++;
+            return p;
+        }
+        m_misses++;
+        m_peak = std::max(m_peak, m_inUse + m_cached);
+    }
+    return cv::fastMalloc(classBytes);
+}
+
+void BufferPool::release(void* p, size_t bytes) {
+    if (p == nullptr) return;
+    size_t classBytes;
+    const int index = sizeClass(bytes, classBytes);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inUse -= classBytes;
+        if (index >= 0 && m_cached + classBytes <= m_limit) {
+            m_free[index].push_back(p);
+            m_cached += classBytes;
+            return;
+        }
+    }
+    cv::fastFree(p);
+}
+
+std::shared_ptr<void> BufferPool::buffer(size_t bytes) {
+    return std::shared_ptr<void>(acquire(bytes), [this, bytes](void* p) { release(p, bytes); });
+}
+
+void BufferPool::setLimit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_limit = bytes;
+    trim();
+}
+
+// frees the largest free buffers first until the cached bytes fit the limit
+void BufferPool::trim() {
+    for (int index = kClasses - 1; index >= 0 && m_cached > m_limit; index--) {
+        auto& list = m_free[index];
+        while (!list.empty() && m_cached > m_limit) {
+            cv::fastFree(list.back());
+            list.pop_back();
+            m_cached -= classSize(index);
+        }
+    }
+}
+
+Sam::PoolStats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Sam::PoolStats stats;
+    stats.inUseBytes = m_inUse;
+    stats.cachedBytes = m_cached;
+    stats.residentBytes = m_inUse + m_cached;
+    stats.peakResidentBytes = m_peak;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    return stats;
+}
+
+// OpenCV's default allocator with the data taken from the pool
+class PoolMatAllocator : public cv::MatAllocator {
+    BufferPool& m_pool;
+
+public:
+    explicit PoolMatAllocator(BufferPool& pool) : m_pool(pool) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                           cv::AccessFlag, cv::UMatUsageFlags) const override {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; i--) {
+            if (step) {
+                if (data0 && step[i] != CV_AUTOSTEP) {
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+        auto* data = data0 ? (uchar*)data0 : (uchar*)m_pool.acquire(total);
+        auto* u = new cv::UMatData(this);
+        u->data = u->origdata = data;
+        u->size = total;
+        if (data0) u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (!u) return;
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+            m_pool.release(u->origdata, u->size);
+            u->origdata = nullptr;
+        }
+        delete u;
+    }
+};
+
+cv::MatAllocator* BufferPool::matAllocator() {
+    static PoolMatAllocator* allocator = new PoolMatAllocator(*this);
+    return allocator;
+}
+
+float* allocateEmbedding(Sam::Embedding& embedding) {
+    auto buffer = BufferPool::shared().buffer(embedding.byteSize());
+    auto* values = static_cast<float*>(buffer.get());
+    embedding.values.clear();
+    embedding.external = values;
+    embedding.owner = std::move(buffer);
+    return values;
+}
@@ -0,0 +1,48 @@
+#ifndef SAMCPP__BUFFER_POOL_H_
+#define SAMCPP__BUFFER_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "edgeSam.h"
+
+// Size class pool of the large buffers (embeddings, encoder batches, masks) shared by every Sam
+// instance. Requests are rounded up to one of four classes per power of two from 4 KB, so at
+// most a quarter is wasted; released buffers stay on their class' free list, up to a byte limit,
+// and later requests of the class reuse them instead of going through the heap. Thread-safe.
+class BufferPool {
+public:
+    // never destroyed, buffers may be released during static destruction
+    static BufferPool& shared();
+
+    // 64 byte aligned, at least bytes long
+    void* acquire(size_t bytes);
+    // p from acquire(bytes)
+    void release(void* p, size_t bytes);
+    // acquire() returned to the pool with the last reference
+    std::shared_ptr<void> buffer(size_t bytes);
+    // cv::Mat allocator over the pool: mats created with it recycle their data on release
+    cv::MatAllocator* matAllocator();
+
+    // bytes of free buffers kept for reuse; lowering it frees the excess
+    void setLimit(size_t bytes);
+    Sam::PoolStats stats() const;
+
+    static const int kClasses = 4 * 40 + 1;
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<void*> m_free[kClasses];
+    size_t m_limit{size_t(256) << 20};
+    size_t m_inUse{0}, m_cached{0}, m_peak{0};
+    uint64_t m_hits{0}, m_misses{0};
+
+    BufferPool() = default;
+    void trim();  // with m_mutex held
+};
+
+// Gives embedding pooled storage for embedding.size() floats through external / owner, returned
+// to the pool with its last handle. Returns the storage to fill.
+float* allocateEmbedding(Sam::Embedding& embedding);
+
+#endif  // SAMCPP__BUFFER_POOL_H_
@@ -0,0 +1,65 @@
+#include "cliOptions.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+int providerType(const std::string& name) {
+    static const std::map<std::string, int> types{
+        {"cpu", 0}, {"cuda", 1}, {"tensorrt", 2}, {"xnnpack", 3}, {"coreml", 4}};
+    auto it = types.find(name);
+    return it == types.end() ? -1 : it->second;
+}
+
+bool parseArgs(int argc, char** argv, ModelOptions& model,
+               const std::function<bool(const std::string&, const std::string&)>& option,
+               std::vector<std::string>* positional, const std::vector<std::string>& flags) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            if (positional == nullptr) {
+                std::cerr << "Unexpected argument " << arg << std::endl;
+                return false;
+            }
+            positional->push_back(arg);
+            continue;
+        }
+        if (std::find(flags.begin(), flags.end(), arg) != flags.end()) {
+            if (!option(arg, "")) return false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--variant") {
+            model.variant = value;
+        } else if (arg == "--models-dir") {
+            model.modelsDir = value;
+        } else if (arg == "--encoder") {
+            model.encoder = value;
+        } else if (arg == "--decoder") {
+            model.decoder = value;
+        } else if (arg == "--provider") {
+            model.provider = value;
+        } else if (arg == "--threads") {
+            model.threads = std::atoi(value.c_str());
+        } else if (!option(arg, value)) {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    model.deviceType = providerType(model.provider);
+    if (model.deviceType < 0) {
+        std::cerr << "Unknown provider " << model.provider << std::endl;
+        return false;
+    }
+    if (model.encoder.empty()) {
+        model.encoder = model.modelsDir + "/" + model.variant + "_encoder.onnx";
+    }
+    if (model.decoder.empty()) {
+        model.decoder = model.modelsDir + "/" + model.variant + "_decoder.onnx";
+    }
+    return true;
+}
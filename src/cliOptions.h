@@ -0,0 +1,31 @@
+#ifndef SAMCPP__CLI_OPTIONS_H_
+#define SAMCPP__CLI_OPTIONS_H_
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Model and provider options shared by the command line tools (edgeSamOrtCpp, sam_bench):
+//   [--variant edge_sam|edge_sam_3x] [--models-dir ../models] [--encoder path] [--decoder path]
+//   [--provider cpu|cuda|tensorrt|xnnpack|coreml] [--threads n]
+struct ModelOptions {
+    std::string variant{"edge_sam_3x"}, modelsDir{"../models"}, encoder, decoder;
+    std::string provider{"cpu"};
+    int threads{(int)std::thread::hardware_concurrency()};
+    int deviceType{0};  // Parameter::Provider::deviceType of provider
+};
+
+// Parameter::Provider::deviceType of a --provider name, -1 - unknown
+int providerType(const std::string& name);
+
+// Parses the "--name value" options of argv. The model options are handled here, the tool's own
+// by option(name, value), which returns false for unknown names. flags: options taking no value,
+// passed to option with an empty value. Other arguments go to positional, an error without it.
+// Unset model paths are derived from modelsDir and variant. Errors are printed, returns false.
+bool parseArgs(int argc, char** argv, ModelOptions& model,
+               const std::function<bool(const std::string&, const std::string&)>& option,
+               std::vector<std::string>* positional = nullptr,
+               const std::vector<std::string>& flags = {});
+
+#endif  // SAMCPP__CLI_OPTIONS_H_
@@ -1,195 +1,1691 @@
 #include "edgeSam.h"
+#include "bufferPool.h"
+#include "embeddingCache.h"
+#include "embeddingCodec.h"
+#include "embeddingIO.h"
+#include "objectPool.h"
+#include "preprocess.h"
+#include "workQueue.h"
 #include <onnxruntime_cxx_api.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#ifdef SAM_WITH_COREML
+#include <coreml_provider_factory.h>
+#endif
+
+static thread_local Sam::Status threadLastError = Sam::Status::Ok;
+
+// Records status for Sam::lastError() and logs message, empty when it was logged already
+static Sam::Status fail(Sam::Status status, const std::string& message) {
+    threadLastError = status;
+    if (!message.empty()) std::cerr << message << std::endl;
+    return status;
+}
+
+// Runs f, turning onnxruntime and OpenCV exceptions into Status::RuntimeError. Returns false on
+// one.
+template <typename F>
+static bool guarded(F&& f) {
+    try {
+        f();
+        return true;
+    } catch (const Ort::Exception& e) {
+        fail(Sam::Status::RuntimeError, std::string("Inference failed: ") + e.what());
+        return false;
+    } catch (const cv::Exception& e) {
+        fail(Sam::Status::RuntimeError, std::string("Image processing failed: ") + e.what());
+        return false;
+    }
+}
+
+// slot: 0 - embedding, 1 - segmentation
+static Ort::SessionOptions createBaseSessionOptions(const Sam::Parameter& param, int slot) {
+    static const GraphOptimizationLevel optimizationLevels[]{
+        ORT_DISABLE_ALL, ORT_ENABLE_BASIC, ORT_ENABLE_EXTENDED, ORT_ENABLE_ALL};
+
+    Ort::SessionOptions options;
+    options.SetGraphOptimizationLevel(
+        optimizationLevels[std::min(std::max(param.graphOptimizationLevel, 0), 3)]);
+    options.SetIntraOpNumThreads(param.threadsNumber);
+    options.SetInterOpNumThreads(param.interOpThreadsNumber);
+    if (param.interOpThreadsNumber > 1) {
+        options.SetExecutionMode(ORT_PARALLEL);
+    }
+    if (!param.profilingPrefix.empty()) {
+        const std::string prefix = param.profilingPrefix + (slot == 0 ? "_encoder" : "_decoder");
+        options.EnableProfiling(prefix.c_str());
+    }
+    return options;
+}
+
+// slot: 0 - embedding, 1 - segmentation
+static Ort::SessionOptions createSessionOptions(const Sam::Parameter& param, int slot) {
+    const auto& provider = param.providers[slot];
+    auto options = createBaseSessionOptions(param, slot);
+
+    try {
+        switch (provider.deviceType) {
+            case 0:
+                break;
+            case 2: {
+                OrtTensorRTProviderOptions trtOptions{};
+                trtOptions.device_id = provider.gpuDeviceId;
+                trtOptions.trt_max_partition_iterations = 1000;
+                trtOptions.trt_min_subgraph_size = 1;
+                trtOptions.trt_max_workspace_size =
+                    provider.gpuMemoryLimit > 0 ? provider.gpuMemoryLimit : 1ull << 30;
+                options.AppendExecutionProvider_TensorRT(trtOptions);
+                // nodes TensorRT cannot take fall back to CUDA rather than CPU
+                [[fallthrough]];
+            }
+            case 1: {
+                OrtCUDAProviderOptions cudaOptions;
+                cudaOptions.device_id = provider.gpuDeviceId;
+                if (provider.gpuMemoryLimit > 0) {
+                    cudaOptions.gpu_mem_limit = provider.gpuMemoryLimit;
+                }
+                options.AppendExecutionProvider_CUDA(cudaOptions);
+                break;
+            }
+            case 3:
+                // XNNPACK runs its own thread pool, the onnxruntime one would only compete with it
+                options.AppendExecutionProvider(
+                    "XNNPACK", {{"intra_op_num_threads", std::to_string(param.threadsNumber)}});
+                options.SetIntraOpNumThreads(1);
+                break;
+            case 4:
+#ifdef SAM_WITH_COREML
+                Ort::ThrowOnError(OrtSessionOptionsAppendExecutionProvider_CoreML(options, 0));
+#else
+                std::cerr << "CoreML support not compiled in, using CPU" << std::endl;
+#endif
+                break;
+            default:
+                std::cerr << "Unknown device type " << provider.deviceType << ", using CPU"
+                          << std::endl;
+        }
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Execution provider " << provider.deviceType
+                  << " not available, using CPU: " << e.what() << std::endl;
+        options = createBaseSessionOptions(param, slot);
+    }
+    return options;
+}
+
+// TensorRT, XNNPACK and CoreML replace nodes with compiled ones, which onnxruntime cannot
+// serialize: their optimized graphs are not cached
+static bool compilesNodes(const Sam::Parameter::Provider& provider) {
+    return provider.deviceType >= 2 && provider.deviceType <= 4;
+}
+
+// Optimized model cache file name: the model hash and every setting the graph depends on
+static std::string optimizedModelKey(const Sam::Parameter& param, int slot, uint64_t modelHash) {
+    const auto& provider = param.providers[slot];
+    char key[128];
+    snprintf(key, sizeof(key), "%016llx-d%d-g%d-m%llu-t%d-O%d.onnx",
+             (unsigned long long)modelHash, provider.deviceType, provider.gpuDeviceId,
+             (unsigned long long)provider.gpuMemoryLimit, param.threadsNumber,
+             param.graphOptimizationLevel);
+    return key;
+}
+
+struct PostprocessScratch {
+    cv::Mat upsampled, lowResBinary;
+};
+
+// Masks created in an empty Mat take their data from the shared pool and give it back when
+// released; reused output Mats keep their buffer
+static void usePool(cv::Mat& mask) {
+    if (mask.empty()) mask.allocator = BufferPool::shared().matAllocator();
+}
+
+// Models converted to fp16 without keeping fp32 inputs/outputs take and return fp16 tensors.
+// The library keeps float buffers and converts at the model boundary; int8 (QDQ) models keep
+// float inputs/outputs and need nothing.
+static bool isFloat16(const Ort::TypeInfo& info) {
+    return info.GetTensorTypeAndShapeInfo().GetElementType() ==
+           ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+}
+
+// fp16 copy of n floats into half, reusing its buffer when the size is unchanged
+static void toHalf(const float* values, size_t n, cv::Mat& half) {
+    cv::Mat(1, (int)n, CV_32FC1, (void*)values).convertTo(half, CV_16F);
+}
+
+static void fromHalf(const cv::Mat& half, float* values) {
+    half.convertTo(cv::Mat(1, (int)half.total(), CV_32FC1, values), CV_32F);
+}
+
+// Tensor over n float values, or for fp16 over their copy in half; refresh it with toHalf when
+// the values change
+static Ort::Value createTensor(const Ort::MemoryInfo& memoryInfo, const float* values, size_t n,
+                               const int64_t* shape, size_t rank, bool fp16, cv::Mat& half) {
+    if (!fp16) {
+        return Ort::Value::CreateTensor<float>(memoryInfo, (float*)values, n, shape, rank);
+    }
+    toHalf(values, n, half);
+    return Ort::Value::CreateTensor<Ort::Float16_t>(memoryInfo, (Ort::Float16_t*)half.data, n,
+                                                    shape, rank);
+}
+
+// Output tensor writing n floats to values, or for fp16 to half for fromHalf to convert
+static Ort::Value createOutputTensor(const Ort::MemoryInfo& memoryInfo, float* values, size_t n,
+                                     const int64_t* shape, size_t rank, bool fp16, cv::Mat& half) {
+    if (!fp16) return Ort::Value::CreateTensor<float>(memoryInfo, values, n, shape, rank);
+    half.create(1, (int)n, CV_16FC1);
+    return Ort::Value::CreateTensor<Ort::Float16_t>(memoryInfo, (Ort::Float16_t*)half.data, n,
+                                                    shape, rank);
+}
+
+// Float data of a float or fp16 tensor, fp16 is converted into scratch
+static const float* floatData(const Ort::Value& tensor, std::vector<float>& scratch) {
+    auto info = tensor.GetTensorTypeAndShapeInfo();
+    if (info.GetElementType() != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+        return tensor.GetTensorData<float>();
+    }
+    const size_t n = info.GetElementCount();
+    scratch.resize(n);
+    fromHalf(cv::Mat(1, (int)n, CV_16FC1, (void*)tensor.GetTensorData<Ort::Float16_t>()),
+             scratch.data());
+    return scratch.data();
+}
+
+// Decoder inputs in the order SamModel binds them; a family takes a prefix of them
+enum DecoderInput {
+    EmbeddingsInput,
+    PointCoordsInput,
+    PointLabelsInput,
+    MaskInput,
+    HasMaskInput,
+    OrigImSizeInput,
+    kDecoderInputs
+};
+
+// IO names of a decoder family, inputs indexed by DecoderInput. Outputs: scores, low resolution
+// mask logits; further outputs of the model (SAM's upscaled masks) are not fetched.
+struct ModelDescriptor {
+    Sam::ModelFamily family;
+    const char* inputs[kDecoderInputs];
+    size_t inputCounts[2];  // accepted input counts
+    const char* outputs[2];
+};
+
+static const ModelDescriptor kModelDescriptors[]{
+    {Sam::ModelFamily::EdgeSam,
+     {"image_embeddings", "point_coords", "point_labels", "mask_input", "has_mask_input", nullptr},
+     {3, 5},
+     {"scores", "masks"}},
+    {Sam::ModelFamily::Sam,
+     {"image_embeddings", "point_coords", "point_labels", "mask_input", "has_mask_input",
+      "orig_im_size"},
+     {6, 6},
+     {"iou_predictions", "low_res_masks"}},
+};
+
+// Points and labels of a prompt as the decoders of family F take them: positive 1, negative 0,
+// roi corners 2 and 3. SAM exports expect a (0, 0) label -1 padding point when there is no box.
+template <Sam::ModelFamily F>
+struct PromptPacker {
+    static constexpr bool kPadding = F == Sam::ModelFamily::Sam;
+
+    static size_t size(const std::list<cv::Point>& points,
+                       const std::list<cv::Point>& negativePoints, const cv::Rect& roi) {
+        return points.size() + negativePoints.size() + (roi.empty() ? (kPadding ? 1 : 0) : 2);
+    }
+
+    // Writes size() points and labels. Prompt coordinates are in the source image, the decoder
+    // takes them in the input frame.
+    static void pack(const Sam::ImageTransform& transform, const std::list<cv::Point>& points,
+                     const std::list<cv::Point>& negativePoints, const cv::Rect& roi,
+                     float* inputPointValues, float* inputLabelValues) {
+        auto append = [&](const cv::Point& point, float label) {
+            const auto p = transform.toInput(point);
+            *inputPointValues++ = p.x;
+            *inputPointValues++ = p.y;
+            *inputLabelValues++ = label;
+        };
+        for (auto& point : points) {
+            append(point, 1);
+        }
+        for (auto& point : negativePoints) {
+            append(point, 0);
+        }
+
+        if (!roi.empty()) {
+            append(roi.tl(), 2);
+            append(roi.br(), 3);
+        } else if constexpr (kPadding) {
+            *inputPointValues++ = 0.f;
+            *inputPointValues++ = 0.f;
+            *inputLabelValues++ = -1.f;
+        }
+    }
+};
+
+// The packer of a family, picked once when the decoder loads
+struct PromptOps {
+    size_t (*size)(const std::list<cv::Point>&, const std::list<cv::Point>&, const cv::Rect&);
+    void (*pack)(const Sam::ImageTransform&, const std::list<cv::Point>&,
+                 const std::list<cv::Point>&, const cv::Rect&, float*, float*);
+};
+
+template <Sam::ModelFamily F>
+static constexpr PromptOps kPromptOps{&PromptPacker<F>::size, &PromptPacker<F>::pack};
+
+static const PromptOps& promptOps(Sam::ModelFamily family) {
+    return family == Sam::ModelFamily::Sam ? kPromptOps<Sam::ModelFamily::Sam>
+                                           : kPromptOps<Sam::ModelFamily::EdgeSam>;
+}
+
+// Per-caller decoder state: fixed capacity prompt storage and input/output buffers bound to the
+// decoder, so steady state decoding does not allocate
+struct DecodeState {
+    Ort::IoBinding binding;
+    Ort::RunOptions runOptions;
+    std::vector<float> inputPointValues, inputLabelValues;
+    size_t boundPoints = 0;  // number of prompt points the inputs are bound with, 0 - unbound
+    // embedding the inputs are bound with; weak, so idle pooled states do not keep it alive and
+    // an expired one never matches the next embedding
+    std::weak_ptr<const Sam::Embedding> boundEmbedding;
+    std::vector<float> outputValues[2];  // 0 - scores, 1 - masks
+    std::vector<int64_t> outputShapes[2];
+    PostprocessScratch scratch;
+    // previous low resolution logits, fed back to decoders taking a mask_input
+    std::vector<float> maskInputValues;
+    float hasMaskInput = 0.f;
+    bool maskInputBound = false;
+    // fp16 copies bound instead of the float buffers for fp16 decoders
+    cv::Mat halfInputs[kDecoderInputs], halfOutputs[2];
+    // getDeviceMasks contexts: masks are left in device memory, a new buffer every run; only
+    // the scores are copied into outputValues
+    bool deviceOutput = false;
+    std::shared_ptr<Ort::Value> deviceMasks;
+
+    DecodeState(Ort::Session& session, size_t maxPoints = 16, bool deviceOutput = false)
+        : binding(session), deviceOutput(deviceOutput) {
+        inputPointValues.resize(2 * maxPoints);
+        inputLabelValues.resize(maxPoints);
+    }
+};
+
+// Reports why a decode through state cannot run: no embedding, no decoder, or a context made for
+// the other kind of output. Returns true when it can.
+static bool checkDecode(const DecodeState* state, const Sam::EmbeddingHandle& embedding,
+                        bool deviceOutput = false) {
+    if (!embedding || !state) {
+        fail(embedding ? Sam::Status::NoDecoder : Sam::Status::NoEmbedding,
+             embedding ? "Decode context not initialized" : "No image loaded");
+        return false;
+    }
+    if (state->deviceOutput != deviceOutput) {
+        fail(Sam::Status::InvalidArgument,
+             deviceOutput ? "Not a device output decode context"
+                          : "Device output contexts only serve getDeviceMasks");
+        return false;
+    }
+    return true;
+}
+
+// Encoder input tensor and resize buffer, one per concurrently running encode()
+struct EncodeBuffer {
+    std::vector<float> values;
+    Ort::Value tensor{nullptr};
+    cv::Mat resizedImage;
+    cv::Rect inputRect;  // area of values written by the last encode() using this buffer
+    cv::Mat halfInput, halfOutput;  // fp16 encoders
+};
+
+// Counters behind Sam::metrics(). Relaxed atomics: concurrent callers only contend on the cache
+// line, and a snapshot need not be consistent across counters.
+struct MetricsCounters {
+    std::atomic<uint64_t> stageCount[4]{}, stageTotalNs[4]{}, stageMaxNs[4]{};
+    std::atomic<uint64_t> cacheHits{0}, cacheMisses{0}, allocations{0};
+
+    void recordStage(Sam::Stage stage, uint64_t nanoseconds) {
+        const int i = (int)stage;
+        stageCount[i].fetch_add(1, std::memory_order_relaxed);
+        stageTotalNs[i].fetch_add(nanoseconds, std::memory_order_relaxed);
+        uint64_t max = stageMaxNs[i].load(std::memory_order_relaxed);
+        while (nanoseconds > max &&
+               !stageMaxNs[i].compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+    void reset() {
+        for (int i = 0; i < 4; i++) {
+            stageCount[i] = stageTotalNs[i] = stageMaxNs[i] = 0;
+        }
+        cacheHits = cacheMisses = allocations = 0;
+    }
+};
+
+// Stage observer and metrics of one model. Disabled, instrumented code only tests two pointers.
+struct Instrumentation {
+    Sam::StageObserver observer;
+    std::unique_ptr<MetricsCounters> counters;  // Parameter::collectMetrics
+
+    bool active() const { return observer || counters; }
+    void countAllocations(uint64_t n = 1) const {
+        if (counters) counters->allocations.fetch_add(n, std::memory_order_relaxed);
+    }
+    void countCacheLookup(bool hit) const {
+        if (counters) (hit ? counters->cacheHits : counters->cacheMisses)++;
+    }
+};
+
+// Reports its lifetime to the stage observer and the metrics, when there are any
+class StageTimer {
+    const Instrumentation& m_instrumentation;
+    Sam::Stage m_stage;
+    bool m_active;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    StageTimer(const Instrumentation& instrumentation, Sam::Stage stage)
+        : m_instrumentation(instrumentation), m_stage(stage), m_active(instrumentation.active()) {
+        if (m_active) m_start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (!m_active) return;
+        const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - m_start;
+        if (m_instrumentation.counters) {
+            m_instrumentation.counters->recordStage(m_stage, elapsed.count());
+        }
+        if (m_instrumentation.observer) m_instrumentation.observer(m_stage, elapsed.count() / 1e6);
+    }
+};
+
+// One onnxruntime environment per process, shared by every Sam instance alive
+static std::shared_ptr<Ort::Env> sharedEnv() {
+    static std::mutex mutex;
+    static std::weak_ptr<Ort::Env> shared;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto env = shared.lock();
+    if (!env) {
+        env = std::make_shared<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "edgeSam");
+        shared = env;
+    }
+    return env;
+}
+
 struct SamModel {
-    Ort::Env env{ORT_LOGGING_LEVEL_WARNING};
+    std::shared_ptr<Ort::Env> env;
     std::unique_ptr<Ort::Session> sessionPre, sessionSam;
 
     std::vector<int64_t> inputShapePre, outputShapePre;
     Ort::MemoryInfo memoryInfo{Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU)};
-    std::vector<float> outputTensorValuesPre;
-    const char *inputNamesEdgeSam[3]{"image_embeddings", "point_coords", "point_labels"},
-        *outputNamesEdgeSam[2]{"scores", "masks"};
+    // Parameter::deviceIo: memory of the GPU both models run on, null - host IO only
+    std::unique_ptr<Ort::MemoryInfo> deviceMemoryInfo;
+    int deviceId = 0;
+    // preallocated encoder inputs, refilled in place; their count bounds concurrent encodes
+    std::unique_ptr<ObjectPool<EncodeBuffer>> encodeBuffers;
+    bool centerLetterbox = false;
+    Sam::EmbeddingHandle currentEmbedding;  // accessed atomically, see current()
+    std::unique_ptr<EmbeddingCache> embeddingCache;
+    Sam::EmbeddingStorage embeddingStorage = Sam::EmbeddingStorage::Float32;
+    // decoder states of getMask calls without a context, one per concurrent caller
+    std::unique_ptr<ObjectPool<DecodeState>> decodeStates;
+    // decoder IO, detected by loadDecoder(); inputs indexed by DecoderInput
+    const ModelDescriptor* descriptor = &kModelDescriptors[0];
+    const PromptOps* packer = &kPromptOps<Sam::ModelFamily::EdgeSam>;
+    const char* const* inputNamesSam = descriptor->inputs;
+    const char* const* outputNamesSam = descriptor->outputs;
+    // encoder IO names as the session reports them
+    std::string encoderNames[2];
+    const char *inputNamesPre[1]{nullptr}, *outputNamesPre[1]{nullptr};
+    // fp16 inputs / outputs: encoder input, encoder output; decoder inputs; decoder outputs
+    bool halfPre[2]{}, halfSam[kDecoderInputs]{}, halfSamOut[2]{};
+    // encoders exported with a dynamic batch axis take several images per Run
+    bool encoderBatchDynamic = false;
+    size_t maxEncoderBatch = 1;
+    // EdgeSam decoders exported with mask_input / has_mask_input take 5 inputs, the others 3;
+    // SAM decoders 6
+    size_t decoderInputCount = 3;
+    int decoderInputIndex[kDecoderInputs]{}, decoderOutputIndex[2]{};  // in the session
+    float origImSize[2]{};  // ModelFamily::Sam: orig_im_size input, (h, w)
+    std::vector<int64_t> maskInputShape, hasMaskInputShape;
+    std::vector<int64_t> embeddingShapeSam;  // decoder image_embeddings input, may be symbolic
+    std::string encoderPath;
+    mutable std::once_flag encoderHashOnce;
+    mutable uint64_t encoderHashValue = 0;
+    // decoders exported with a dynamic batch axis take several prompts per Run
+    bool decoderBatchDynamic = false;
+    size_t maxDecoderBatch = 1;
 
-    bool bModelLoaded = false;
-    SamModel(const Sam::Parameter& param) {
-        for (auto& p : param.models) {
-            std::ifstream f(p);
-            if (!f.good()) {
-                std::cerr << "Model file " << p << " not found" << std::endl;
-                return;
-            }
-        }
+    // mutable: a lazy decoder load failing on first use unloads the model
+    mutable std::atomic<bool> bModelLoaded{false};
+    mutable std::atomic<Sam::Status> loadStatus{Sam::Status::Ok};
+    Instrumentation instrumentation;
+    std::atomic<bool> profiling{false};
+    size_t encodeQueueSize = 2;
+    std::mutex encodeQueueMutex;
+    // decoder session build running next to the encoder one, joined by decoderReady()
+    mutable std::future<Sam::Status> decoderLoad;
+    mutable std::once_flag decoderLoadOnce;
+    mutable Sam::Status decoderStatus = Sam::Status::Ok;
+    // declared last: destroyed first, finishing its queued encodes while the sessions exist
+    std::unique_ptr<WorkQueue> encodeQueue;
 
-        auto wpreModelPath = param.models[0];
-        auto wsamModelPath = param.models[1];
+    static bool hasModel(const Sam::Parameter& param, int slot) {
+        return !param.models[slot].empty() || param.modelBuffers[slot].data != nullptr;
+    }
 
-        sessionPre = std::make_unique<Ort::Session>(env, wpreModelPath.c_str(),
-                                                    Ort::SessionOptions{nullptr});
-        int targetNumber[]{1, 3};
-        if (sessionPre->GetInputCount() != 1 || sessionPre->GetOutputCount() != targetNumber[0]) {
-            std::cerr << "Preprocessing model not loaded (invalid input/output count)" << std::endl;
+    // Either model may be missing, for encoder-only or decoder-only instances
+    SamModel(const Sam::Parameter& param) : env(sharedEnv()) {
+        if (!hasModel(param, 0) && !hasModel(param, 1)) {
+            loadStatus = fail(Sam::Status::ModelNotFound, "No model given");
             return;
         }
 
-        sessionSam = std::make_unique<Ort::Session>(env, wsamModelPath.c_str(),
-                                                    Ort::SessionOptions{nullptr});
-        const auto samOutputCount = sessionSam->GetOutputCount();
-        if (sessionSam->GetInputCount() != targetNumber[1]) {
-            std::cerr << "Model not loaded (invalid input/output count)" << std::endl;
+        centerLetterbox = param.centerLetterbox;
+        instrumentation.observer = param.stageObserver;
+        if (param.collectMetrics) instrumentation.counters = std::make_unique<MetricsCounters>();
+        maxDecoderBatch = std::max(param.maxDecoderBatch, 1);
+        encodeQueueSize = std::max(param.encodeQueueSize, 1);
+        if (param.embeddingCacheBytes > 0) {
+            embeddingCache = std::make_unique<EmbeddingCache>(param.embeddingCacheBytes);
+        }
+        if (param.deviceIo) {
+            auto onGpu = [](const Sam::Parameter::Provider& provider) {
+                return provider.deviceType == 1 || provider.deviceType == 2;
+            };
+            const auto &encoder = param.providers[0], &decoder = param.providers[1];
+            if (onGpu(encoder) && onGpu(decoder) && encoder.gpuDeviceId == decoder.gpuDeviceId) {
+                deviceId = encoder.gpuDeviceId;
+                deviceMemoryInfo = std::make_unique<Ort::MemoryInfo>("Cuda", OrtDeviceAllocator,
+                                                                     deviceId, OrtMemTypeDefault);
+            } else {
+                std::cerr << "deviceIo needs CUDA or TensorRT on one device for both models, "
+                             "using host memory"
+                          << std::endl;
+            }
+        }
+        // device embeddings have no host values to compress
+        if (!deviceMemoryInfo) embeddingStorage = param.embeddingStorage;
+
+        // the sessions are built in parallel, the decoder one on a second thread
+        if (hasModel(param, 1)) {
+            decoderLoad = std::async(std::launch::async, [this, param]() {
+                const auto status = loadDecoder(param);
+                if (status == Sam::Status::Ok && param.warmup) warmupDecoder();
+                return status;
+            });
+        }
+        if (hasModel(param, 0) && (loadStatus = loadEncoder(param)) != Sam::Status::Ok) {
+            if (decoderLoad.valid()) decoderLoad.wait();
             return;
         }
+        profiling = !param.profilingPrefix.empty();
+        bModelLoaded = true;
+        if (param.warmup && sessionPre) warmupEncoder();
+        if (!param.lazyDecoder) decoderReady();
+    }
+
+    // Session of slot from Parameter::modelBuffers or models, through the optimized model cache
+    // when there is one. modelHash receives the model content hash when it was computed.
+    static std::unique_ptr<Ort::Session> createSession(Ort::Env& env, const Sam::Parameter& param,
+                                                       int slot, uint64_t& modelHash) {
+        const auto& path = param.models[slot];
+        const auto& buffer = param.modelBuffers[slot];
+        const bool fromMemory = buffer.data != nullptr;
+        const std::string name = fromMemory ? "buffer " + std::to_string(slot) : path;
+        if (!fromMemory && !std::ifstream(path).good()) {
+            fail(Sam::Status::ModelNotFound, "Model file " + path + " not found");
+            return nullptr;
+        }
+
+        auto options = createSessionOptions(param, slot);
+        std::string cachePath, cacheTemp;
+        if (!param.optimizedModelDir.empty() && !compilesNodes(param.providers[slot])) {
+            modelHash = fromMemory ? hashBytes(buffer.data, buffer.size) : hashFile(path);
+            cachePath = param.optimizedModelDir + "/" + optimizedModelKey(param, slot, modelHash);
+            if (std::ifstream(cachePath).good()) {
+                // optimized already, only the execution provider partitioning is left
+                options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+                try {
+                    return std::make_unique<Ort::Session>(env, cachePath.c_str(), options);
+                } catch (const Ort::Exception& e) {
+                    std::cerr << "Optimized model " << cachePath << " ignored: " << e.what()
+                              << std::endl;
+                    options = createSessionOptions(param, slot);
+                }
+            }
+            // written next to it and renamed once complete, processes starting together may
+            // share the directory
+            cacheTemp = cachePath + ".tmp" +
+                        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+            options.SetOptimizedModelFilePath(cacheTemp.c_str());
+        }
+
+        auto create = [&]() {
+            return fromMemory
+                       ? std::make_unique<Ort::Session>(env, buffer.data, buffer.size, options)
+                       : std::make_unique<Ort::Session>(env, path.c_str(), options);
+        };
+        try {
+            try {
+                auto session = create();
+                if (!cacheTemp.empty() &&
+                    std::rename(cacheTemp.c_str(), cachePath.c_str()) != 0) {
+                    std::remove(cacheTemp.c_str());
+                }
+                return session;
+            } catch (const Ort::Exception& e) {
+                if (cacheTemp.empty()) throw;
+                // writing the optimized graph failed (e.g. an execution provider falling back
+                // to a compiling one), load the model once more without caching it
+                std::remove(cacheTemp.c_str());
+                std::cerr << "Optimized model " << cachePath << " not written: " << e.what()
+                          << std::endl;
+                options = createSessionOptions(param, slot);
+                return create();
+            }
+        } catch (const Ort::Exception& e) {
+            fail(Sam::Status::InvalidModel, "Model " + name + " not loaded: " + e.what());
+            return nullptr;
+        }
+    }
+
+    Sam::Status loadEncoder(const Sam::Parameter& param) {
+        encoderPath = param.models[0];
+        uint64_t modelHash = 0;
+        sessionPre = createSession(*env, param, 0, modelHash);
+        if (!sessionPre) return threadLastError;
+        // buffers are gone by the time an embedding file needs the hash
+        if (param.modelBuffers[0].data != nullptr && modelHash == 0) {
+            modelHash = hashBytes(param.modelBuffers[0].data, param.modelBuffers[0].size);
+        }
+        encoderHashValue = modelHash;
+        if (sessionPre->GetInputCount() != 1 || sessionPre->GetOutputCount() != 1) {
+            return fail(Sam::Status::InvalidModel,
+                        "Preprocessing model not loaded (invalid input/output count)");
+        }
+        {
+            Ort::AllocatorWithDefaultOptions allocator;
+            encoderNames[0] = sessionPre->GetInputNameAllocated(0, allocator).get();
+            encoderNames[1] = sessionPre->GetOutputNameAllocated(0, allocator).get();
+            inputNamesPre[0] = encoderNames[0].c_str();
+            outputNamesPre[0] = encoderNames[1].c_str();
+        }
 
         inputShapePre = sessionPre->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
         outputShapePre = sessionPre->GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
         if (inputShapePre.size() != 4 || outputShapePre.size() != 4) {
-            std::cerr << "Preprocessing model not loaded (invalid shape)" << std::endl;
-            return;
+            return fail(Sam::Status::InvalidModel,
+                        "Preprocessing model not loaded (invalid shape)");
+        }
+        // a symbolic batch axis is 1 for single image encodes, see encodeBatch
+        encoderBatchDynamic = inputShapePre[0] < 0;
+        inputShapePre[0] = outputShapePre[0] = 1;
+        for (size_t i = 1; i < 4; i++) {
+            if (inputShapePre[i] < 0 || outputShapePre[i] < 0) {
+                return fail(Sam::Status::InvalidModel,
+                            "Preprocessing model not loaded (dynamic image size)");
+            }
         }
+        maxEncoderBatch = std::max(param.maxEncoderBatch, 1);
+        halfPre[0] = isFloat16(sessionPre->GetInputTypeInfo(0));
+        halfPre[1] = isFloat16(sessionPre->GetOutputTypeInfo(0));
+        encodeBuffers = std::make_unique<ObjectPool<EncodeBuffer>>(
+            [this]() {
+                instrumentation.countAllocations();
+                auto buffer = std::make_unique<EncodeBuffer>();
+                buffer->values.resize(inputShapePre[0] * inputShapePre[1] * inputShapePre[2] *
+                                      inputShapePre[3]);
+                buffer->tensor = Ort::Value::CreateTensor<float>(
+                    memoryInfo, buffer->values.data(), buffer->values.size(),
+                    inputShapePre.data(), inputShapePre.size());
+                buffer->inputRect = cv::Rect(0, 0, inputShapePre[3], inputShapePre[2]);
+                return buffer;
+            },
+            std::max(param.maxConcurrentEncodes, 1));
+        return Sam::Status::Ok;
+    }
 
-        bModelLoaded = true;
+    // Matches the decoder's IO names against the known families, setting descriptor, prompts and
+    // the session indexes of the inputs and outputs used
+    bool detectDecoder() {
+        Ort::AllocatorWithDefaultOptions allocator;
+        std::vector<std::string> inputs, outputs;
+        for (size_t i = 0; i < sessionSam->GetInputCount(); i++) {
+            inputs.emplace_back(sessionSam->GetInputNameAllocated(i, allocator).get());
+        }
+        for (size_t i = 0; i < sessionSam->GetOutputCount(); i++) {
+            outputs.emplace_back(sessionSam->GetOutputNameAllocated(i, allocator).get());
+        }
+        // SAM exports are told apart by orig_im_size
+        const bool sam = std::find(inputs.begin(), inputs.end(), "orig_im_size") != inputs.end();
+        descriptor = &kModelDescriptors[sam ? 1 : 0];
+        packer = &promptOps(descriptor->family);
+        inputNamesSam = descriptor->inputs;
+        outputNamesSam = descriptor->outputs;
+
+        decoderInputCount = inputs.size();
+        if (decoderInputCount != descriptor->inputCounts[0] &&
+            decoderInputCount != descriptor->inputCounts[1]) {
+            fail(Sam::Status::InvalidModel, "Model not loaded (invalid input/output count)");
+            return false;
+        }
+        std::fill(std::begin(decoderInputIndex), std::end(decoderInputIndex), -1);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            const auto* names = descriptor->inputs;
+            const auto* role = std::find_if(names, names + kDecoderInputs, [&](const char* name) {
+                return name != nullptr && inputs[i] == name;
+            });
+            if (role == names + kDecoderInputs) {
+                // e.g. SAM2 decoders, taking the high resolution encoder features as well
+                fail(Sam::Status::InvalidModel,
+                     "Model not loaded (unsupported decoder input " + inputs[i] + ")");
+                return false;
+            }
+            decoderInputIndex[role - names] = (int)i;
+        }
+        // the family's inputs are used in DecoderInput order, the first decoderInputCount of them
+        for (size_t i = 0; i < decoderInputCount; i++) {
+            if (decoderInputIndex[i] < 0) {
+                fail(Sam::Status::InvalidModel, "Model not loaded (missing decoder input " +
+                                                    std::string(inputNamesSam[i]) + ")");
+                return false;
+            }
+        }
+        for (size_t i = 0; i < 2; i++) {
+            auto output = std::find(outputs.begin(), outputs.end(), outputNamesSam[i]);
+            if (output == outputs.end()) {
+                fail(Sam::Status::InvalidModel, "Model not loaded (missing decoder output " +
+                                                    std::string(outputNamesSam[i]) + ")");
+                return false;
+            }
+            decoderOutputIndex[i] = (int)(output - outputs.begin());
+        }
+        return true;
+    }
+
+    Sam::Status loadDecoder(const Sam::Parameter& param) {
+        uint64_t modelHash = 0;
+        sessionSam = createSession(*env, param, 1, modelHash);
+        if (!sessionSam) return threadLastError;
+        if (!detectDecoder()) return threadLastError;
+        auto inputInfo = [this](int input) {
+            return sessionSam->GetInputTypeInfo(decoderInputIndex[input]);
+        };
+        embeddingShapeSam = inputInfo(EmbeddingsInput).GetTensorTypeAndShapeInfo().GetShape();
+        for (size_t i = 0; i < decoderInputCount; i++) {
+            halfSam[i] = isFloat16(inputInfo((int)i));
+        }
+        for (size_t i = 0; i < 2; i++) {
+            halfSamOut[i] = isFloat16(sessionSam->GetOutputTypeInfo(decoderOutputIndex[i]));
+        }
+        if (decoderInputCount > MaskInput) {
+            maskInputShape = inputInfo(MaskInput).GetTensorTypeAndShapeInfo().GetShape();
+            hasMaskInputShape = inputInfo(HasMaskInput).GetTensorTypeAndShapeInfo().GetShape();
+            if (maskInputShape.size() != 4 || embeddingShapeSam.size() != 4) {
+                return fail(Sam::Status::InvalidModel,
+                            "Model not loaded (invalid mask_input shape)");
+            }
+            // symbolic dimensions: batch 1, the low resolution mask is 4x the embedding grid
+            const int64_t defaults[]{1, 1, 4 * embeddingShapeSam[2], 4 * embeddingShapeSam[3]};
+            for (size_t i = 0; i < 4; i++) {
+                if (maskInputShape[i] < 0) maskInputShape[i] = defaults[i];
+            }
+            for (auto& d : hasMaskInputShape) {
+                if (d < 0) d = 1;
+            }
+            // SAM still computes its masks output, scaled to orig_im_size, though it is not
+            // fetched; the low resolution mask size keeps that cheap
+            origImSize[0] = (float)defaults[2];
+            origImSize[1] = (float)defaults[3];
+        }
+
+        auto pointShape = inputInfo(PointCoordsInput).GetTensorTypeAndShapeInfo().GetShape();
+        decoderBatchDynamic = !pointShape.empty() && pointShape[0] < 0;
+        decodeStates = std::make_unique<ObjectPool<DecodeState>>(
+            [this]() {
+                instrumentation.countAllocations();
+                return std::make_unique<DecodeState>(*sessionSam);
+            });
+        return Sam::Status::Ok;
+    }
+
+    bool hasEncoder() const { return bModelLoaded && sessionPre; }
+
+    // Joins the decoder session build. A failure is reported to every caller and unloads the
+    // model.
+    bool decoderReady() const {
+        std::call_once(decoderLoadOnce, [this]() {
+            if (decoderLoad.valid()) decoderStatus = decoderLoad.get();
+            if (decoderStatus != Sam::Status::Ok) {
+                loadStatus = decoderStatus;
+                bModelLoaded = false;
+            }
+        });
+        if (decoderStatus != Sam::Status::Ok) {
+            fail(decoderStatus, "");
+            return false;
+        }
+        return true;
+    }
+
+    // hashed on first use (unless the optimized model cache did), it reads the whole model file
+    uint64_t encoderHash() const {
+        if (!hasEncoder()) return 0;
+        std::call_once(encoderHashOnce, [this]() {
+            if (encoderHashValue == 0) encoderHashValue = hashFile(encoderPath);
+        });
+        return encoderHashValue;
+    }
+
+    void warmupEncoder() {
+        guarded([this]() { encode(cv::Mat::zeros(getInputSize(), CV_8UC3)); });
+        if (embeddingCache) embeddingCache->clear();
+    }
+
+    // Decodes a center point on a blank embedding through a pooled state, which keeps the
+    // bindings made by the run
+    void warmupDecoder() {
+        auto embedding = std::make_shared<Sam::Embedding>();
+        static const int64_t defaults[]{1, 256, 64, 64};
+        for (size_t i = 0; i < 4; i++) {
+            embedding->shape.push_back(embeddingShapeSam[i] >= 0 ? embeddingShapeSam[i]
+                                                                 : defaults[i]);
+        }
+        embedding->values.assign(embedding->size(), 0.f);
+        // the input frame is 16 times the embedding grid
+        const cv::Size inputSize(16 * embedding->shape[3], 16 * embedding->shape[2]);
+        embedding->transform.sourceSize = embedding->transform.resizedSize =
+            embedding->transform.inputSize = inputSize;
+        guarded([&]() {
+            auto state = decodeStates->acquire();
+            decode(*state, embedding, {cv::Point(inputSize.width / 2, inputSize.height / 2)}, {},
+                   cv::Rect(), false);
+        });
+    }
+
+    Sam::EmbeddingHandle loadEmbedding(const std::string& path) const {
+        uint64_t modelHash = 0;
+        auto embedding = readEmbeddingFile(path, &modelHash, embeddingStorage);
+        if (!embedding) {
+            fail(Sam::Status::InvalidEmbedding, "");
+            return nullptr;
+        }
+        if (hasEncoder() && modelHash != encoderHash()) {
+            fail(Sam::Status::InvalidEmbedding,
+                 "Embedding " + path + " was made by another encoder model");
+            return nullptr;
+        }
+        if (hasDecoder()) {
+            for (size_t i = 0; i < 4; i++) {
+                if (embeddingShapeSam[i] >= 0 && embeddingShapeSam[i] != embedding->shape[i]) {
+                    fail(Sam::Status::InvalidEmbedding,
+                         "Embedding " + path + " does not fit the decoder");
+                    return nullptr;
+                }
+            }
+        }
+        return embedding;
+    }
+    bool hasDecoder() const {
+        if (!bModelLoaded || !decoderReady()) return false;
+        return sessionSam != nullptr;
     }
 
     cv::Size getInputSize() const {
-        if (!bModelLoaded) return cv::Size(0, 0);
+        if (!hasEncoder()) {
+            fail(Sam::Status::NoEncoder, "");
+            return cv::Size(0, 0);
+        }
         return cv::Size(inputShapePre[3], inputShapePre[2]);
     }
     bool loadImage(const cv::Mat& image) {
-        if (image.size() != cv::Size(inputShapePre[3], inputShapePre[2])) {
-            std::cerr << "Image size not match" << std::endl;
+        auto embedding = encode(image);
+        if (!embedding) return false;
+        setCurrent(embedding);
+        return true;
+    }
+
+    // the loaded image, replaced by loadImageAsync from the worker thread
+    Sam::EmbeddingHandle current() const { return std::atomic_load(&currentEmbedding); }
+    void setCurrent(const Sam::EmbeddingHandle& embedding) {
+        std::atomic_store(&currentEmbedding, embedding);
+    }
+
+    std::future<Sam::EmbeddingHandle> encodeAsync(const cv::Mat& image, bool load) {
+        {
+            std::lock_guard<std::mutex> lock(encodeQueueMutex);
+            if (!encodeQueue) encodeQueue = std::make_unique<WorkQueue>(encodeQueueSize);
+        }
+        // the caller may reuse its buffer (e.g. video frames) while the encode is pending
+        auto task = std::make_shared<std::packaged_task<Sam::EmbeddingHandle()>>(
+            [this, image = image.clone(), load]() {
+                Sam::EmbeddingHandle embedding;
+                guarded([&]() { embedding = encode(image); });
+                if (embedding && load) setCurrent(embedding);
+                return embedding;
+            });
+        auto result = task->get_future();
+        encodeQueue->push([task]() { (*task)(); });
+        return result;
+    }
+
+    static bool checkImage(const cv::Mat& image) {
+        if (image.empty()) {
+            fail(Sam::Status::InvalidImage, "Image is empty");
             return false;
         }
-        if (image.channels() != 3) {
-            std::cerr << "Input is not a 3-channel image" << std::endl;
+        if (image.type() != CV_8UC3) {
+            fail(Sam::Status::InvalidImage, "Input is not a 3-channel 8-bit image");
             return false;
         }
+        return true;
+    }
 
-        std::vector<float> inputTensorValuesFloat;
-        inputTensorValuesFloat.resize(inputShapePre[0] * inputShapePre[1] * inputShapePre[2] *
-                                      inputShapePre[3]);
-        for (int i = 0; i < inputShapePre[2]; i++) {
-            for (int j = 0; j < inputShapePre[3]; j++) {
-                inputTensorValuesFloat[i * inputShapePre[3] + j] = image.at<cv::Vec3b>(i, j)[2];
-                inputTensorValuesFloat[inputShapePre[2] * inputShapePre[3] + i * inputShapePre[3] +
-                                       j] = image.at<cv::Vec3b>(i, j)[1];
-                inputTensorValuesFloat[2 * inputShapePre[2] * inputShapePre[3] +
-                                       i * inputShapePre[3] + j] = image.at<cv::Vec3b>(i, j)[0];
-            }
+    // Letterboxes image into one [3, H, W] plane set of the encoder input. slotRect is the area
+    // written by the previous image in that slot, the padding is only cleared when it changes.
+    Sam::ImageTransform prepareInput(const cv::Mat& image, float* slot, cv::Rect& slotRect,
+                                     cv::Mat& resizedImage) const {
+        const cv::Size inputSize(inputShapePre[3], inputShapePre[2]);
+        const auto transform = letterbox(image.size(), inputSize, centerLetterbox);
+        const cv::Rect inputRect = transform.inputRect();
+
+        const cv::Mat* source = &image;
+        if (inputRect.size() != image.size()) {
+            const int interpolation = transform.scale < 1.0 ? cv::INTER_AREA : cv::INTER_LINEAR;
+            cv::resize(image, resizedImage, inputRect.size(), 0, 0, interpolation);
+            source = &resizedImage;
+        }
+        if (inputRect != slotRect) {
+            std::fill(slot, slot + 3 * inputSize.area(), 0.f);
+            slotRect = inputRect;
+        }
+
+        // fused HWC -> CHW, BGR -> RGB and 1/255 scaling straight into the input tensor
+        float* inputOrigin = slot + inputRect.y * inputSize.width + inputRect.x;
+        packBgrToPlanarRgb(*source, inputOrigin, inputSize.width, inputSize.area(), 1.f / 255.f);
+        return transform;
+    }
+
+    Sam::EmbeddingHandle encode(const cv::Mat& image) {
+        if (!hasEncoder()) {
+            fail(Sam::Status::NoEncoder, "Encoder not loaded");
+            return nullptr;
+        }
+        if (!checkImage(image)) return nullptr;
+
+        uint64_t key = 0;
+        if (embeddingCache) {
+            key = hashImage(image);
+            auto cached = embeddingCache->find(key);
+            instrumentation.countCacheLookup(cached != nullptr);
+            if (cached) return cached;
         }
 
-        for (auto& v : inputTensorValuesFloat) {
-            v /= 255.;
+        // blocks while maxConcurrentEncodes encodes are running
+        auto buffer = encodeBuffers->acquire();
+        Sam::ImageTransform transform;
+        {
+            StageTimer timer(instrumentation, Sam::Stage::Preprocess);
+            transform = prepareInput(image, buffer->values.data(), buffer->inputRect,
+                                     buffer->resizedImage);
         }
 
-        auto inputTensor = Ort::Value::CreateTensor<float>(
-            memoryInfo, inputTensorValuesFloat.data(), inputTensorValuesFloat.size(),
-            inputShapePre.data(), inputShapePre.size());
+        instrumentation.countAllocations();
+        auto embedding = std::make_shared<Sam::Embedding>();
+        embedding->key = key;
+        embedding->transform = transform;
+        embedding->shape = outputShapePre;
+        if (deviceMemoryInfo) {
+            runEncoderOnDevice(*buffer, *embedding);
+            if (embeddingCache) embeddingCache->insert(embedding);
+            return embedding;
+        }
+        float* values = allocateEmbedding(*embedding);
         std::vector<Ort::Value> outputTensors;
-        outputTensorValuesPre = std::vector<float>(outputShapePre[0] * outputShapePre[1] *
-                                                   outputShapePre[2] * outputShapePre[3]);
-        outputTensors.push_back(Ort::Value::CreateTensor<float>(
-            memoryInfo, outputTensorValuesPre.data(), outputTensorValuesPre.size(),
-            outputShapePre.data(), outputShapePre.size()));
+        outputTensors.push_back(createOutputTensor(memoryInfo, values, embedding->size(),
+                                                   embedding->shape.data(),
+                                                   embedding->shape.size(), halfPre[1],
+                                                   buffer->halfOutput));
 
-        Ort::RunOptions run_options;
-        const char *inputNamesPreEdge[] = {"image"}, *outputNamesPreEdge[] = {"image_embeddings"};
-        sessionPre->Run(run_options, inputNamesPreEdge, &inputTensor, 1, outputNamesPreEdge,
-                        outputTensors.data(), outputTensors.size());
+        {
+            StageTimer timer(instrumentation, Sam::Stage::EncoderRun);
+            Ort::Value halfInput{nullptr};
+            if (halfPre[0]) {
+                halfInput = createTensor(memoryInfo, buffer->values.data(), buffer->values.size(),
+                                         inputShapePre.data(), inputShapePre.size(), true,
+                                         buffer->halfInput);
+            }
+            Ort::RunOptions run_options;
+            sessionPre->Run(run_options, inputNamesPre,
+                            halfPre[0] ? &halfInput : &buffer->tensor, 1, outputNamesPre,
+                            outputTensors.data(), outputTensors.size());
+            if (halfPre[1]) fromHalf(buffer->halfOutput, values);
+        }
+        convertEmbedding(*embedding, embeddingStorage);
 
-        return true;
+        if (embeddingCache) {
+            embeddingCache->insert(embedding);
+        }
+        return embedding;
     }
 
-    void getMask(const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
-                 const cv::Rect& roi, cv::Mat& outputMaskSam, double& iouValue) const {
-        const size_t maskInputSize = 256 * 256;
-        float maskInputValues[maskInputSize],
-            hasMaskValues[] = {0},
-            orig_im_size_values[] = {(float)inputShapePre[2], (float)inputShapePre[3]};
-        memset(maskInputValues, 0, sizeof(maskInputValues));
+    // Encoder run leaving the embedding in device memory, ORT allocates it there
+    void runEncoderOnDevice(EncodeBuffer& buffer, Sam::Embedding& embedding) {
+        StageTimer timer(instrumentation, Sam::Stage::EncoderRun);
+        Ort::IoBinding binding(*sessionPre);
+        Ort::Value halfInput{nullptr};
+        if (halfPre[0]) {
+            halfInput = createTensor(memoryInfo, buffer.values.data(), buffer.values.size(),
+                                     inputShapePre.data(), inputShapePre.size(), true,
+                                     buffer.halfInput);
+        }
+        binding.BindInput(inputNamesPre[0], halfPre[0] ? halfInput : buffer.tensor);
+        binding.BindOutput(outputNamesPre[0], *deviceMemoryInfo);
+        sessionPre->Run(Ort::RunOptions(), binding);
+        auto outputs = binding.GetOutputValues();
+        embedding.device = std::make_shared<Ort::Value>(std::move(outputs[0]));
+    }
 
-        std::vector<float> inputPointValues, inputLabelValues;
-        for (auto& point : points) {
-            inputPointValues.push_back((float)point.x);
-            inputPointValues.push_back((float)point.y);
-            inputLabelValues.push_back(1);
+    // Decoder image_embeddings input over embedding: device embeddings are wrapped as they are,
+    // host ones converted to fp16 into half for fp16 decoders. Compressed embeddings are
+    // expanded into half, but fp16 ones feed fp16 decoders as they are.
+    Ort::Value embeddingTensor(const Sam::Embedding& embedding, cv::Mat& half) const {
+        if (embedding.isCompressed()) {
+            const void* values = embedding.compressed;
+            if (embedding.storage != Sam::EmbeddingStorage::Float16 || !halfSam[0]) {
+                expandEmbedding(embedding, half, halfSam[0] ? CV_16F : CV_32F);
+                values = half.data;
+            }
+            return Ort::Value::CreateTensor(
+                memoryInfo, const_cast<void*>(values), embedding.size() * (halfSam[0] ? 2 : 4),
+                embedding.shape.data(), embedding.shape.size(),
+                halfSam[0] ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16
+                           : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
         }
-        for (auto& point : negativePoints) {
-            inputPointValues.push_back((float)point.x);
-            inputPointValues.push_back((float)point.y);
-            inputLabelValues.push_back(0);
+        if (!embedding.onDevice()) {
+            return createTensor(memoryInfo, embedding.data(), embedding.size(),
+                                embedding.shape.data(), embedding.shape.size(), halfSam[0], half);
+        }
+        if (!deviceMemoryInfo) {
+            throw Ort::Exception("Device embedding given to a Sam without deviceIo",
+                                 ORT_INVALID_ARGUMENT);
         }
+        const auto& value = *static_cast<const Ort::Value*>(embedding.device.get());
+        const auto info = value.GetTensorTypeAndShapeInfo();
+        const auto type = info.GetElementType();
+        const size_t elementSize = type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 ? 2 : 4;
+        return Ort::Value::CreateTensor(*deviceMemoryInfo,
+                                        const_cast<void*>(value.GetTensorData<void>()),
+                                        info.GetElementCount() * elementSize,
+                                        embedding.shape.data(), embedding.shape.size(), type);
+    }
 
-        if (!roi.empty()) {
-            inputPointValues.push_back((float)roi.x);
-            inputPointValues.push_back((float)roi.y);
-            inputLabelValues.push_back(2);
-            inputPointValues.push_back((float)roi.br().x);
-            inputPointValues.push_back((float)roi.br().y);
-            inputLabelValues.push_back(3);
-        }
-
-        const int numPoints = inputLabelValues.size();
-        std::vector<int64_t> inputPointShape = {1, numPoints, 2}, pointLabelsShape = {1, numPoints},
-                             maskInputShape = {1, 1, 256, 256}, hasMaskInputShape = {1},
-                             origImSizeShape = {2};
-
-        std::vector<Ort::Value> inputTensorsSam;
-        inputTensorsSam.push_back(Ort::Value::CreateTensor<float>(
-            memoryInfo, (float*)outputTensorValuesPre.data(), outputTensorValuesPre.size(),
-            outputShapePre.data(), outputShapePre.size()));
-
-        auto inputNames = inputNamesEdgeSam;
-        auto outputNames = outputNamesEdgeSam;
-        int outputNumber = 2;
-        int outputMaskIndex = 1;
-        int outputIOUIndex = 0;
-
-        inputTensorsSam.push_back(
-            Ort::Value::CreateTensor<float>(memoryInfo, inputPointValues.data(), 2 * numPoints,
-                                            inputPointShape.data(), inputPointShape.size()));
-        inputTensorsSam.push_back(
-            Ort::Value::CreateTensor<float>(memoryInfo, inputLabelValues.data(), numPoints,
-                                            pointLabelsShape.data(), pointLabelsShape.size()));
-
-        if (outputMaskSam.type() != CV_8UC1 ||
-            outputMaskSam.size() != cv::Size(inputShapePre[3], inputShapePre[2])) {
-            outputMaskSam = cv::Mat(inputShapePre[2], inputShapePre[3], CV_8UC1);
+    // Input and output of one encoder Run over up to maxEncoderBatch images
+    struct EncodeBatch {
+        std::shared_ptr<void> inputBuffer, outputBuffer;  // pooled
+        float *input{nullptr}, *output{nullptr};
+        std::vector<cv::Rect> slotRects;
+        std::vector<cv::Mat> resizedImages;
+        std::vector<size_t> indices;  // image of each slot
+        std::vector<Sam::ImageTransform> transforms;
+        cv::Mat halfInput, halfOutput;  // fp16 encoders
+    };
+
+    // statuses: receives the Status of every image
+    std::vector<Sam::EmbeddingHandle> encodeBatch(const std::vector<cv::Mat>& images,
+                                                  std::vector<Sam::Status>& statuses) {
+        std::vector<Sam::EmbeddingHandle> embeddings(images.size());
+        statuses.assign(images.size(), Sam::Status::Ok);
+        if (!hasEncoder()) {
+            statuses.assign(images.size(), fail(Sam::Status::NoEncoder, "Encoder not loaded"));
+            return embeddings;
+        }
+        // device embeddings are one tensor each, a batch output cannot be split in place
+        if (deviceMemoryInfo) {
+            for (size_t i = 0; i < images.size(); i++) {
+                embeddings[i] = encode(images[i]);
+                if (!embeddings[i]) statuses[i] = threadLastError;
+            }
+            return embeddings;
         }
 
-        Ort::RunOptions runOptionsSam;
-        auto outputTensorsSam = sessionSam->Run(runOptionsSam, inputNames, inputTensorsSam.data(),
-                                                inputTensorsSam.size(), outputNames, outputNumber);
+        // cache hits and invalid images are left out of the batches
+        std::vector<uint64_t> keys(images.size(), 0);
+        std::vector<size_t> pending;
+        for (size_t i = 0; i < images.size(); i++) {
+            if (!checkImage(images[i])) {
+                statuses[i] = Sam::Status::InvalidImage;
+                continue;
+            }
+            if (embeddingCache) {
+                keys[i] = hashImage(images[i]);
+                embeddings[i] = embeddingCache->find(keys[i]);
+                instrumentation.countCacheLookup(embeddings[i] != nullptr);
+                if (embeddings[i]) continue;
+            }
+            pending.push_back(i);
+        }
+        if (pending.empty()) return embeddings;
+
+        const size_t batchSize = encoderBatchDynamic ? maxEncoderBatch : 1;
+        const size_t inputStride = inputShapePre[1] * inputShapePre[2] * inputShapePre[3],
+                     outputStride = outputShapePre[1] * outputShapePre[2] * outputShapePre[3];
+        EncodeBatch batches[2];
+        instrumentation.countAllocations(2);
+        for (auto& batch : batches) {
+            batch.inputBuffer =
+                BufferPool::shared().buffer(batchSize * inputStride * sizeof(float));
+            batch.outputBuffer =
+                BufferPool::shared().buffer(batchSize * outputStride * sizeof(float));
+            batch.input = static_cast<float*>(batch.inputBuffer.get());
+            batch.output = static_cast<float*>(batch.outputBuffer.get());
+            batch.slotRects.resize(batchSize);
+            batch.resizedImages.resize(batchSize);
+        }
 
-        auto& outputMask = outputTensorsSam[outputMaskIndex];
-        auto maskShape = outputMask.GetTensorTypeAndShapeInfo().GetShape();
+        auto prepare = [&](EncodeBatch& batch, size_t first) {
+            StageTimer timer(instrumentation, Sam::Stage::Preprocess);
+            const size_t count = std::min(batchSize, pending.size() - first);
+            batch.indices.assign(pending.begin() + first, pending.begin() + first + count);
+            batch.transforms.resize(count);
+            cv::parallel_for_(cv::Range(0, (int)count), [&](const cv::Range& range) {
+                for (int j = range.start; j < range.end; j++) {
+                    batch.transforms[j] =
+                        prepareInput(images[batch.indices[j]], batch.input + j * inputStride,
+                                     batch.slotRects[j], batch.resizedImages[j]);
+                }
+            });
+        };
+        auto run = [&](EncodeBatch& batch) {
+            StageTimer timer(instrumentation, Sam::Stage::EncoderRun);
+            const size_t count = batch.indices.size();
+            const int64_t inputShape[]{(int64_t)count, inputShapePre[1], inputShapePre[2],
+                                       inputShapePre[3]},
+                outputShape[]{(int64_t)count, outputShapePre[1], outputShapePre[2],
+                              outputShapePre[3]};
+            auto input = createTensor(memoryInfo, batch.input, count * inputStride,
+                                      inputShape, 4, halfPre[0], batch.halfInput);
+            auto output = createOutputTensor(memoryInfo, batch.output,
+                                             count * outputStride, outputShape, 4, halfPre[1],
+                                             batch.halfOutput);
+            Ort::RunOptions runOptions;
+            sessionPre->Run(runOptions, inputNamesPre, &input, 1, outputNamesPre, &output, 1);
+            if (halfPre[1]) fromHalf(batch.halfOutput, batch.output);
+        };
 
-        cv::Mat outputMaskImage(maskShape[2], maskShape[3], CV_32FC1,
-                                outputMask.GetTensorMutableData<float>());
+        // double buffered: batch k+1 is preprocessed while the encoder runs batch k
+        prepare(batches[0], 0);
+        for (size_t first = 0, k = 0; first < pending.size(); first += batchSize, k++) {
+            auto& batch = batches[k % 2];
+            auto running = std::async(std::launch::async, run, std::ref(batch));
+            if (first + batchSize < pending.size()) {
+                prepare(batches[(k + 1) % 2], first + batchSize);
+            }
+            running.get();
 
-        if (outputMaskImage.size() != outputMaskSam.size()) {
-            cv::resize(outputMaskImage, outputMaskImage, outputMaskSam.size());
+            instrumentation.countAllocations(batch.indices.size());
+            for (size_t j = 0; j < batch.indices.size(); j++) {
+                auto embedding = std::make_shared<Sam::Embedding>();
+                embedding->key = keys[batch.indices[j]];
+                embedding->transform = batch.transforms[j];
+                embedding->shape = outputShapePre;
+                const float* output = batch.output + j * outputStride;
+                if (embeddingStorage == Sam::EmbeddingStorage::Float32) {
+                    std::copy(output, output + outputStride, allocateEmbedding(*embedding));
+                } else {
+                    // compressed straight from the batch output
+                    embedding->external = output;
+                    convertEmbedding(*embedding, embeddingStorage);
+                }
+                if (embeddingCache) embeddingCache->insert(embedding);
+                embeddings[batch.indices[j]] = std::move(embedding);
+            }
         }
+        return embeddings;
+    }
 
-        for (int i = 0; i < outputMaskSam.rows; i++) {
-            for (int j = 0; j < outputMaskSam.cols; j++) {
-                outputMaskSam.at<uint8_t>(i, j) = outputMaskImage.at<float>(i, j) > 0 ? 255 : 0;
+    void appendPrompt(const Sam::ImageTransform& transform, const std::list<cv::Point>& points,
+                      const std::list<cv::Point>& negativePoints, const cv::Rect& roi,
+                      std::vector<float>& inputPointValues,
+                      std::vector<float>& inputLabelValues) const {
+        const size_t offset = inputLabelValues.size();
+        const size_t numPoints = packer->size(points, negativePoints, roi);
+        inputPointValues.resize(2 * (offset + numPoints));
+        inputLabelValues.resize(offset + numPoints);
+        packer->pack(transform, points, negativePoints, roi, inputPointValues.data() + 2 * offset,
+                     inputLabelValues.data() + offset);
+    }
+
+    // lowResMask: one mask candidate of the decoder output, maskSize floats covering the input
+    // frame. The image part of it is cropped out and scaled to the source resolution.
+    void postprocessMask(const float* lowResMask, const cv::Size& maskSize,
+                         const Sam::ImageTransform& transform, cv::Mat& outputMaskSam,
+                         PostprocessScratch& scratch, float threshold = 0.f) const {
+        usePool(outputMaskSam);
+        cv::Mat outputMaskImage =
+            cv::Mat(maskSize, CV_32FC1, (void*)lowResMask)(lowResCrop(maskSize, transform));
+        if (outputMaskImage.size() != transform.sourceSize) {
+            cv::resize(outputMaskImage, scratch.upsampled, transform.sourceSize);
+            outputMaskImage = scratch.upsampled;
+        }
+        // vectorized, writes 255 / 0 into outputMaskSam, reusing its buffer when it fits
+        cv::compare(outputMaskImage, threshold, outputMaskSam, cv::CMP_GT);
+    }
+
+    // roi: prompt box in source coordinates, used by MaskOutput::BoxCropped. region receives
+    // the source rectangle outputMaskSam covers.
+    void postprocessMask(const float* lowResMask, const cv::Size& maskSize,
+                         const Sam::ImageTransform& transform, const Sam::MaskOptions& options,
+                         const cv::Rect& roi, cv::Mat& outputMaskSam, PostprocessScratch& scratch,
+                         cv::Rect* box, cv::Rect* region = nullptr) const {
+        usePool(outputMaskSam);
+        const cv::Mat lowRes(maskSize, CV_32FC1, (void*)lowResMask);
+        const cv::Rect crop = lowResCrop(maskSize, transform);
+        const cv::Rect sourceRect(cv::Point(), transform.sourceSize);
+
+        cv::Rect maskBox;
+        if (box != nullptr || options.output == Sam::MaskOutput::MaskCropped) {
+            // from the low resolution mask, accurate to one low resolution pixel. Upsampling
+            // interpolates between pixel centers, so the foreground may reach half a low
+            // resolution pixel further.
+            cv::compare(lowRes(crop), options.threshold, scratch.lowResBinary, cv::CMP_GT);
+            const cv::Rect b = cv::boundingRect(scratch.lowResBinary);
+            const double sx = (double)transform.sourceSize.width / crop.width,
+                         sy = (double)transform.sourceSize.height / crop.height;
+            const cv::Point tl(cvFloor((b.x - 0.5) * sx), cvFloor((b.y - 0.5) * sy)),
+                br(cvCeil((b.br().x + 0.5) * sx), cvCeil((b.br().y + 0.5) * sy));
+            maskBox = b.empty() ? cv::Rect() : cv::Rect(tl, br) & sourceRect;
+            if (box != nullptr) *box = maskBox;
+        }
+
+        // thresholds region of the source resolution mask, sampled with the mapping the full
+        // frame resize would use
+        auto sampleRegion = [&](const cv::Rect& region) {
+            const double sx = (double)crop.width / transform.sourceSize.width,
+                         sy = (double)crop.height / transform.sourceSize.height;
+            const double m[]{sx, 0, (region.x + 0.5) * sx - 0.5 + crop.x,
+                             0, sy, (region.y + 0.5) * sy - 0.5 + crop.y};
+            cv::warpAffine(lowRes, scratch.upsampled, cv::Mat(2, 3, CV_64FC1, (void*)m),
+                           region.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP,
+                           cv::BORDER_REPLICATE);
+            cv::compare(scratch.upsampled, options.threshold, outputMaskSam, cv::CMP_GT);
+        };
+
+        cv::Rect covered = sourceRect;
+        switch (options.output) {
+            case Sam::MaskOutput::LowResLogits:
+                lowRes.copyTo(outputMaskSam);
+                covered = cv::Rect(transform.toSource(cv::Point2f()),
+                                   transform.toSource(cv::Point2f(transform.inputSize.width,
+                                                                  transform.inputSize.height)));
+                break;
+            case Sam::MaskOutput::Probability: {
+                cv::Mat logits = lowRes(crop);
+                if (logits.size() != transform.sourceSize) {
+                    cv::resize(logits, scratch.upsampled, transform.sourceSize);
+                    logits = scratch.upsampled;
+                }
+                // sigmoid
+                cv::multiply(logits, -1.0, outputMaskSam);
+                cv::exp(outputMaskSam, outputMaskSam);
+                cv::add(outputMaskSam, 1.0, outputMaskSam);
+                cv::divide(1.0, outputMaskSam, outputMaskSam);
+                break;
             }
+            case Sam::MaskOutput::MaskCropped:
+                if (maskBox.empty()) {
+                    outputMaskSam.release();
+                } else {
+                    sampleRegion(maskBox);
+                }
+                covered = maskBox;
+                break;
+            case Sam::MaskOutput::BoxCropped: {
+                const int padding = std::max(options.roiPadding, 0);
+                const cv::Rect padded =
+                    roi.empty() ? roi
+                                : cv::Rect(roi.x - padding, roi.y - padding,
+                                           roi.width + 2 * padding, roi.height + 2 * padding) &
+                                      sourceRect;
+                if (!padded.empty()) {
+                    sampleRegion(padded);
+                    covered = padded;
+                    break;
+                }
+                [[fallthrough]];
+            }
+            case Sam::MaskOutput::Binary:
+                postprocessMask(lowResMask, maskSize, transform, outputMaskSam, scratch,
+                                options.threshold);
+                break;
         }
+        if (region != nullptr) *region = covered;
+    }
 
-        iouValue = outputTensorsSam[outputIOUIndex].GetTensorMutableData<float>()[0];
+    // Runs the decoder, leaving scores and masks of all candidates in state.outputValues.
+    // refine: feed the mask kept by rememberMask() back to decoders taking a mask_input.
+    void decode(DecodeState& state, const Sam::EmbeddingHandle& embedding,
+                const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
+                const cv::Rect& roi, bool refine) const {
+        const size_t numPoints = packer->size(points, negativePoints, roi);
+        if (numPoints > state.inputLabelValues.size()) {
+            instrumentation.countAllocations();
+            state.inputPointValues.resize(2 * numPoints);
+            state.inputLabelValues.resize(numPoints);
+            state.boundPoints = 0;
+        }
+        packer->pack(embedding->transform, points, negativePoints, roi,
+                     state.inputPointValues.data(), state.inputLabelValues.data());
+
+        // inputs are only rebound when their shape or the embedding changes
+        if (state.boundPoints != numPoints) {
+            const int64_t inputPointShape[]{1, (int64_t)numPoints, 2},
+                pointLabelsShape[]{1, (int64_t)numPoints};
+            state.binding.BindInput(
+                inputNamesSam[1],
+                createTensor(memoryInfo, state.inputPointValues.data(), 2 * numPoints,
+                             inputPointShape, 3, halfSam[1], state.halfInputs[1]));
+            state.binding.BindInput(
+                inputNamesSam[2],
+                createTensor(memoryInfo, state.inputLabelValues.data(), numPoints,
+                             pointLabelsShape, 2, halfSam[2], state.halfInputs[2]));
+            state.boundPoints = numPoints;
+        } else {
+            // the fp16 copies are bound, refresh them in place
+            if (halfSam[1]) {
+                toHalf(state.inputPointValues.data(), 2 * numPoints, state.halfInputs[1]);
+            }
+            if (halfSam[2]) {
+                toHalf(state.inputLabelValues.data(), numPoints, state.halfInputs[2]);
+            }
+        }
+        if (state.boundEmbedding.lock() != embedding) {
+            state.binding.BindInput(inputNamesSam[0],
+                                    embeddingTensor(*embedding, state.halfInputs[0]));
+            state.boundEmbedding = embedding;
+            // the kept mask belongs to the previous image
+            state.hasMaskInput = 0.f;
+        }
+        if (decoderInputCount > MaskInput) {
+            if (!refine) state.hasMaskInput = 0.f;
+            if (!state.maskInputBound) {
+                state.maskInputValues.assign(maskInputShape[0] * maskInputShape[1] *
+                                                 maskInputShape[2] * maskInputShape[3],
+                                             0.f);
+                state.binding.BindInput(
+                    inputNamesSam[3],
+                    createTensor(memoryInfo, state.maskInputValues.data(),
+                                 state.maskInputValues.size(), maskInputShape.data(),
+                                 maskInputShape.size(), halfSam[3], state.halfInputs[3]));
+                state.binding.BindInput(
+                    inputNamesSam[4],
+                    createTensor(memoryInfo, &state.hasMaskInput, 1, hasMaskInputShape.data(),
+                                 hasMaskInputShape.size(), halfSam[4], state.halfInputs[4]));
+                if (decoderInputCount > OrigImSizeInput) {
+                    const int64_t origImSizeShape[]{2};
+                    state.binding.BindInput(
+                        inputNamesSam[OrigImSizeInput],
+                        createTensor(memoryInfo, origImSize, 2, origImSizeShape, 1,
+                                     halfSam[OrigImSizeInput],
+                                     state.halfInputs[OrigImSizeInput]));
+                }
+                state.maskInputBound = true;
+            } else {
+                if (halfSam[3]) {
+                    toHalf(state.maskInputValues.data(), state.maskInputValues.size(),
+                           state.halfInputs[3]);
+                }
+                if (halfSam[4]) toHalf(&state.hasMaskInput, 1, state.halfInputs[4]);
+            }
+        }
+
+        StageTimer timer(instrumentation, Sam::Stage::DecoderRun);
+        if (state.deviceOutput) {
+            // rebinding the masks makes the run allocate a new buffer instead of overwriting
+            // the one a caller may still hold
+            instrumentation.countAllocations(2);
+            state.binding.BindOutput(outputNamesSam[0], memoryInfo);
+            state.binding.BindOutput(outputNamesSam[1], *deviceMemoryInfo);
+            sessionSam->Run(state.runOptions, state.binding);
+            auto outputs = state.binding.GetOutputValues();
+            auto info = outputs[0].GetTensorTypeAndShapeInfo();
+            state.outputShapes[0] = info.GetShape();
+            std::vector<float> scratch;
+            const float* scores = floatData(outputs[0], scratch);
+            state.outputValues[0].assign(scores, scores + info.GetElementCount());
+            state.outputShapes[1] = outputs[1].GetTensorTypeAndShapeInfo().GetShape();
+            state.deviceMasks = std::make_shared<Ort::Value>(std::move(outputs[1]));
+            return;
+        }
+        if (state.outputValues[0].empty()) {
+            // output shapes are symbolic in the model, let the first run allocate them
+            instrumentation.countAllocations(2);
+            state.binding.BindOutput(outputNamesSam[0], memoryInfo);
+            state.binding.BindOutput(outputNamesSam[1], memoryInfo);
+            sessionSam->Run(state.runOptions, state.binding);
+
+            auto outputs = state.binding.GetOutputValues();
+            for (int i = 0; i < 2; i++) {
+                auto info = outputs[i].GetTensorTypeAndShapeInfo();
+                state.outputShapes[i] = info.GetShape();
+                std::vector<float> scratch;
+                const float* values = floatData(outputs[i], scratch);
+                state.outputValues[i].assign(values, values + info.GetElementCount());
+                state.binding.BindOutput(
+                    outputNamesSam[i],
+                    createOutputTensor(memoryInfo, state.outputValues[i].data(),
+                                       state.outputValues[i].size(), state.outputShapes[i].data(),
+                                       state.outputShapes[i].size(), halfSamOut[i],
+                                       state.halfOutputs[i]));
+            }
+        } else {
+            sessionSam->Run(state.runOptions, state.binding);
+            for (int i = 0; i < 2; i++) {
+                if (halfSamOut[i]) fromHalf(state.halfOutputs[i], state.outputValues[i].data());
+            }
+        }
+    }
+
+    // Keeps one candidate of the last decode() as the mask_input of the next refining one
+    void rememberMask(DecodeState& state, size_t candidate) const {
+        if (!state.maskInputBound || state.deviceOutput) return;
+        const auto& maskShape = state.outputShapes[1];
+        const size_t area = maskShape[2] * maskShape[3];
+        if (maskShape[2] != maskInputShape[2] || maskShape[3] != maskInputShape[3]) return;
+        const float* lowRes = state.outputValues[1].data() + candidate * area;
+        std::copy(lowRes, lowRes + area, state.maskInputValues.begin());
+        state.hasMaskInput = 1.f;
+    }
+
+    void getMask(DecodeState& state, const Sam::EmbeddingHandle& embedding,
+                 const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
+                 const cv::Rect& roi, const Sam::MaskOptions& options, cv::Mat& outputMaskSam,
+                 double& iouValue, cv::Rect* box = nullptr, cv::Rect* region = nullptr) const {
+        decode(state, embedding, points, negativePoints, roi, options.refine);
+
+        // masks: [1, candidates, h, w], scores: [1, candidates]
+        const auto& maskShape = state.outputShapes[1];
+        const float* scores = state.outputValues[0].data();
+        const size_t candidate =
+            options.bestCandidate ? std::max_element(scores, scores + maskShape[1]) - scores : 0;
+        const cv::Size maskSize(maskShape[3], maskShape[2]);
+        // only the selected candidate is upsampled
+        StageTimer timer(instrumentation, Sam::Stage::Postprocess);
+        postprocessMask(state.outputValues[1].data() + candidate * maskSize.area(), maskSize,
+                        embedding->transform, options, roi, outputMaskSam, state.scratch, box,
+                        region);
+        iouValue = scores[candidate];
+        rememberMask(state, candidate);
+    }
+
+    void getDeviceMasks(DecodeState& state, const Sam::EmbeddingHandle& embedding,
+                        const Sam::Prompt& prompt, Sam::DeviceMasks& masks,
+                        std::vector<double>* iouValues) const {
+        decode(state, embedding, prompt.points, prompt.negativePoints, prompt.roi, false);
+        const auto info = state.deviceMasks->GetTensorTypeAndShapeInfo();
+        masks.shape = info.GetShape();
+        masks.fp16 = info.GetElementType() == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+        masks.data = state.deviceMasks->GetTensorData<void>();
+        masks.deviceId = deviceId;
+        masks.owner = std::move(state.deviceMasks);
+        if (iouValues != nullptr) {
+            iouValues->assign(state.outputValues[0].begin(), state.outputValues[0].end());
+        }
+    }
+
+    void getMaskCandidates(DecodeState& state, const Sam::EmbeddingHandle& embedding,
+                           const std::list<cv::Point>& points,
+                           const std::list<cv::Point>& negativePoints, const cv::Rect& roi,
+                           const Sam::MaskOptions& options, std::vector<cv::Mat>& outputMasks,
+                           std::vector<double>& iouValues) const {
+        decode(state, embedding, points, negativePoints, roi, options.refine);
+
+        const auto& maskShape = state.outputShapes[1];
+        const size_t candidates = maskShape[1];
+        const cv::Size maskSize(maskShape[3], maskShape[2]);
+        outputMasks.resize(candidates);
+        iouValues.resize(candidates);
+        StageTimer timer(instrumentation, Sam::Stage::Postprocess);
+        for (size_t i = 0; i < candidates; i++) {
+            postprocessMask(state.outputValues[1].data() + i * maskSize.area(), maskSize,
+                            embedding->transform, options, roi, outputMasks[i], state.scratch,
+                            nullptr);
+            iouValues[i] = state.outputValues[0][i];
+        }
+        // refinement continues from the best scoring candidate
+        const float* scores = state.outputValues[0].data();
+        rememberMask(state, std::max_element(scores, scores + candidates) - scores);
+    }
+
+    // regions: optional, receives the source rectangle of every mask. candidateCount: keep every
+    // candidate instead of one per prompt, those of prompt i at i * *candidateCount.
+    void getMasks(const Sam::Embedding& embedding, const std::vector<Sam::Prompt>& prompts,
+                  const Sam::MaskOptions& options, std::vector<cv::Mat>& outputMasks,
+                  std::vector<double>& iouValues, std::vector<cv::Rect>* regions,
+                  size_t* candidateCount = nullptr) const {
+        outputMasks.resize(prompts.size());
+        iouValues.resize(prompts.size());
+        if (regions != nullptr) regions->resize(prompts.size());
+        if (prompts.empty()) return;
+
+        // the embedding tensor wraps embedding.data() or its expanded copy, build it once for
+        // all the runs
+        cv::Mat halfInputs[kDecoderInputs];  // fp16 decoders
+        Ort::Value inputTensors[kDecoderInputs]{
+            embeddingTensor(embedding, halfInputs[0]), Ort::Value{nullptr}, Ort::Value{nullptr},
+            Ort::Value{nullptr}, Ort::Value{nullptr}, Ort::Value{nullptr}};
+        std::vector<float> inputPointValues, inputLabelValues, maskInputValues;
+        float hasMaskInput = 0.f;
+        if (decoderInputCount > MaskInput) {
+            // batched prompts never refine: one empty mask with has_mask_input 0, broadcast
+            maskInputValues.assign(maskInputShape[0] * maskInputShape[1] * maskInputShape[2] *
+                                       maskInputShape[3],
+                                   0.f);
+            inputTensors[3] = createTensor(memoryInfo, maskInputValues.data(),
+                                           maskInputValues.size(), maskInputShape.data(),
+                                           maskInputShape.size(), halfSam[3], halfInputs[3]);
+            inputTensors[4] = createTensor(memoryInfo, &hasMaskInput, 1, hasMaskInputShape.data(),
+                                           hasMaskInputShape.size(), halfSam[4], halfInputs[4]);
+        }
+        if (decoderInputCount > OrigImSizeInput) {
+            const int64_t origImSizeShape[]{2};
+            inputTensors[OrigImSizeInput] =
+                createTensor(memoryInfo, origImSize, 2, origImSizeShape, 1,
+                             halfSam[OrigImSizeInput], halfInputs[OrigImSizeInput]);
+        }
+        std::vector<float> scoreScratch, maskScratch;
+        Ort::RunOptions runOptionsSam;
+        PostprocessScratch scratch;
+
+        const size_t batchSize = decoderBatchDynamic ? maxDecoderBatch : 1;
+        for (size_t first = 0; first < prompts.size(); first += batchSize) {
+            const size_t count = std::min(batchSize, prompts.size() - first);
+
+            size_t numPoints = 0;
+            for (size_t i = first; i < first + count; i++) {
+                numPoints = std::max(numPoints, packer->size(prompts[i].points,
+                                                             prompts[i].negativePoints,
+                                                             prompts[i].roi));
+            }
+
+            // prompts of one batch share the points dimension, shorter ones are padded with
+            // label -1 points the decoder ignores
+            inputPointValues.clear();
+            inputLabelValues.clear();
+            for (size_t i = first; i < first + count; i++) {
+                auto& prompt = prompts[i];
+                appendPrompt(embedding.transform, prompt.points, prompt.negativePoints,
+                             prompt.roi, inputPointValues, inputLabelValues);
+                inputPointValues.resize(2 * numPoints * (i - first + 1), 0.f);
+                inputLabelValues.resize(numPoints * (i - first + 1), -1.f);
+            }
+
+            const int64_t inputPointShape[]{(int64_t)count, (int64_t)numPoints, 2},
+                pointLabelsShape[]{(int64_t)count, (int64_t)numPoints};
+            inputTensors[1] =
+                createTensor(memoryInfo, inputPointValues.data(), inputPointValues.size(),
+                             inputPointShape, 3, halfSam[1], halfInputs[1]);
+            inputTensors[2] =
+                createTensor(memoryInfo, inputLabelValues.data(), inputLabelValues.size(),
+                             pointLabelsShape, 2, halfSam[2], halfInputs[2]);
+
+            std::vector<Ort::Value> outputTensorsSam;
+            {
+                StageTimer timer(instrumentation, Sam::Stage::DecoderRun);
+                outputTensorsSam = sessionSam->Run(runOptionsSam, inputNamesSam, inputTensors,
+                                                   decoderInputCount, outputNamesSam, 2);
+            }
+            instrumentation.countAllocations(2);
+
+            auto& outputMask = outputTensorsSam[1];
+            auto maskShape = outputMask.GetTensorTypeAndShapeInfo().GetShape();
+            const float* maskValues = floatData(outputMask, maskScratch);
+            const float* scoreValues = floatData(outputTensorsSam[0], scoreScratch);
+            // masks: [batch, candidates, h, w], scores: [batch, candidates]
+            const size_t candidates = maskShape[1];
+            const size_t maskStride = candidates * maskShape[2] * maskShape[3];
+            const cv::Size maskSize(maskShape[3], maskShape[2]);
+            if (candidateCount != nullptr && first == 0) {
+                *candidateCount = candidates;
+                outputMasks.resize(prompts.size() * candidates);
+                iouValues.resize(prompts.size() * candidates);
+                if (regions != nullptr) regions->resize(prompts.size() * candidates);
+            }
+            auto postprocess = [&](size_t i, size_t candidate, size_t output) {
+                postprocessMask(maskValues + i * maskStride + candidate * maskSize.area(),
+                                maskSize, embedding.transform, options, prompts[first + i].roi,
+                                outputMasks[output], scratch, nullptr,
+                                regions != nullptr ? &(*regions)[output] : nullptr);
+                iouValues[output] = scoreValues[i * candidates + candidate];
+            };
+            StageTimer timer(instrumentation, Sam::Stage::Postprocess);
+            for (size_t i = 0; i < count; i++) {
+                if (candidateCount != nullptr) {
+                    for (size_t c = 0; c < candidates; c++) {
+                        postprocess(i, c, (first + i) * candidates + c);
+                    }
+                    continue;
+                }
+                const float* scores = scoreValues + i * candidates;
+                postprocess(i,
+                            options.bestCandidate
+                                ? std::max_element(scores, scores + candidates) - scores
+                                : 0,
+                            first + i);
+            }
+        }
     }
 };
 
 Sam::Sam(const Parameter& param) : m_model(new SamModel(param)) {}
 Sam::~Sam() { delete m_model; }
 
+const char* Sam::statusMessage(Status status) {
+    switch (status) {
+        case Status::Ok:
+            return "ok";
+        case Status::ModelNotFound:
+            return "model not found";
+        case Status::InvalidModel:
+            return "invalid model";
+        case Status::NoEncoder:
+            return "encoder not loaded";
+        case Status::NoDecoder:
+            return "decoder not loaded";
+        case Status::InvalidImage:
+            return "invalid image";
+        case Status::NoEmbedding:
+            return "no image loaded";
+        case Status::InvalidEmbedding:
+            return "invalid embedding";
+        case Status::InvalidArgument:
+            return "invalid argument";
+        case Status::IoError:
+            return "i/o error";
+        case Status::RuntimeError:
+            return "inference failed";
+    }
+    return "unknown status";
+}
+
+bool Sam::isLoaded() const { return m_model->bModelLoaded; }
+Sam::Status Sam::loadStatus() const { return m_model->loadStatus; }
+Sam::Status Sam::lastError() { return threadLastError; }
 cv::Size Sam::getInputSize() const { return m_model->getInputSize(); }
-bool Sam::loadImage(const cv::Mat& image) { return m_model->loadImage(image); }
+Sam::ModelFamily Sam::modelFamily() const {
+    return m_model->hasDecoder() ? m_model->descriptor->family : ModelFamily::EdgeSam;
+}
+
+bool Sam::loadImage(const cv::Mat& image) {
+    bool loaded = false;
+    guarded([&]() { loaded = m_model->loadImage(image); });
+    return loaded;
+}
+
+Sam::EmbeddingHandle Sam::encode(const cv::Mat& image) {
+    EmbeddingHandle embedding;
+    guarded([&]() { embedding = m_model->encode(image); });
+    return embedding;
+}
+
+std::vector<Sam::EmbeddingHandle> Sam::encodeBatch(const std::vector<cv::Mat>& images,
+                                                   std::vector<Status>* statuses) {
+    std::vector<EmbeddingHandle> embeddings;
+    std::vector<Status> imageStatuses(images.size(), Status::Ok);
+    if (!guarded([&]() { embeddings = m_model->encodeBatch(images, imageStatuses); })) {
+        // a failed run drops the whole call, the images rejected before keep their reason
+        embeddings.assign(images.size(), nullptr);
+        imageStatuses.resize(images.size(), Status::Ok);
+        for (auto& status : imageStatuses) {
+            if (status == Status::Ok) status = lastError();
+        }
+    }
+    if (statuses != nullptr) *statuses = std::move(imageStatuses);
+    return embeddings;
+}
+
+std::future<Sam::EmbeddingHandle> Sam::encodeAsync(const cv::Mat& image) {
+    return m_model->encodeAsync(image, false);
+}
+std::future<Sam::EmbeddingHandle> Sam::loadImageAsync(const cv::Mat& image) {
+    return m_model->encodeAsync(image, true);
+}
+
+bool Sam::saveEmbedding(const EmbeddingHandle& embedding, const std::string& path,
+                        bool fp16) const {
+    if (!embedding) {
+        fail(Status::NoEmbedding, "No embedding");
+        return false;
+    }
+    if (embedding->onDevice()) {
+        fail(Status::InvalidArgument, "Device embeddings cannot be saved");
+        return false;
+    }
+    if (!writeEmbeddingFile(*embedding, path, m_model->encoderHash(), fp16)) {
+        fail(Status::IoError, "");
+        return false;
+    }
+    return true;
+}
+
+Sam::EmbeddingHandle Sam::loadEmbedding(const std::string& path) const {
+    return m_model->loadEmbedding(path);
+}
+
+uint64_t Sam::encoderHash() const { return m_model->encoderHash(); }
+
+void Sam::clearEmbeddingCache() {
+    if (m_model->embeddingCache) {
+        m_model->embeddingCache->clear();
+    }
+}
 
 cv::Mat Sam::getMask(const cv::Point& point, double* iou) const {
     return getMask({point}, {}, {}, iou);
@@ -202,11 +1698,268 @@ cv::Mat Sam::getMask(const std::list<cv::Point>& points, const std::list<cv::Poi
 
 cv::Mat Sam::getMask(const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
                      const cv::Rect& roi, double* iou) const {
+    return getMask(m_model->current(), points, negativePoints, roi, iou);
+}
+
+cv::Mat Sam::getMask(const EmbeddingHandle& embedding, const std::list<cv::Point>& points,
+                     const std::list<cv::Point>& negativePoints, const cv::Rect& roi,
+                     double* iou) const {
+    if (!embedding) {
+        fail(Status::NoEmbedding, "No image loaded");
+        return cv::Mat();
+    }
+    if (!m_model->hasDecoder()) {
+        fail(Status::NoDecoder, "Decoder not loaded");
+        return cv::Mat();
+    }
     double iouValue = 0;
     cv::Mat m;
-    m_model->getMask(points, negativePoints, roi, m, iouValue);
+    // a pooled state per concurrent caller, its bindings are reused by later calls
+    auto state = m_model->decodeStates->acquire();
+    if (!guarded([&]() {
+            m_model->getMask(*state, embedding, points, negativePoints, roi, Sam::MaskOptions(), m,
+                             iouValue);
+        })) {
+        return cv::Mat();
+    }
+    if (iou != nullptr) {
+        *iou = iouValue;
+    }
+    return m;
+}
+
+Sam::DecodeContext::DecodeContext(const Sam& sam, size_t maxPoints, bool deviceOutput) {
+    if (sam.m_model->hasDecoder()) {
+        sam.m_model->instrumentation.countAllocations();
+        m_state = new DecodeState(*sam.m_model->sessionSam, std::max<size_t>(maxPoints, 1),
+                                  deviceOutput);
+    }
+}
+Sam::DecodeContext::~DecodeContext() { delete m_state; }
+
+void Sam::DecodeContext::reset() {
+    if (m_state) {
+        m_state->hasMaskInput = 0.f;
+    }
+}
+
+bool Sam::getMask(DecodeContext& context, const EmbeddingHandle& embedding,
+                  const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
+                  const cv::Rect& roi, cv::Mat& mask, double* iou) const {
+    if (!checkDecode(context.m_state, embedding)) return false;
+    double iouValue = 0;
+    if (!guarded([&]() {
+            m_model->getMask(*context.m_state, embedding, points, negativePoints, roi,
+                             MaskOptions(), mask, iouValue);
+        })) {
+        return false;
+    }
+    if (iou != nullptr) {
+        *iou = iouValue;
+    }
+    return true;
+}
+
+bool Sam::getDeviceMasks(DecodeContext& context, const EmbeddingHandle& embedding,
+                         const Prompt& prompt, DeviceMasks& masks,
+                         std::vector<double>* ious) const {
+    if (!checkDecode(context.m_state, embedding, true)) return false;
+    if (!m_model->deviceMemoryInfo) {
+        fail(Status::InvalidArgument, "Device masks need Parameter::deviceIo on a GPU provider");
+        return false;
+    }
+    return guarded(
+        [&]() { m_model->getDeviceMasks(*context.m_state, embedding, prompt, masks, ious); });
+}
+
+bool Sam::getMaskCandidates(DecodeContext& context, const EmbeddingHandle& embedding,
+                            const Prompt& prompt, const MaskOptions& options,
+                            std::vector<cv::Mat>& masks, std::vector<double>& ious) const {
+    if (!checkDecode(context.m_state, embedding)) return false;
+    return guarded([&]() {
+        m_model->getMaskCandidates(*context.m_state, embedding, prompt.points,
+                                   prompt.negativePoints, prompt.roi, options, masks, ious);
+    });
+}
+
+bool Sam::getMask(DecodeContext& context, const EmbeddingHandle& embedding, const Prompt& prompt,
+                  const MaskOptions& options, cv::Mat& mask, double* iou, cv::Rect* box,
+                  cv::Rect* region) const {
+    if (!checkDecode(context.m_state, embedding)) return false;
+    double iouValue = 0;
+    if (!guarded([&]() {
+            m_model->getMask(*context.m_state, embedding, prompt.points, prompt.negativePoints,
+                             prompt.roi, options, mask, iouValue, box, region);
+        })) {
+        return false;
+    }
     if (iou != nullptr) {
         *iou = iouValue;
     }
+    return true;
+}
+
+std::vector<cv::Mat> Sam::getMasks(const std::vector<Prompt>& prompts,
+                                   std::vector<double>* ious) const {
+    return getMasks(m_model->current(), prompts, ious);
+}
+
+std::vector<cv::Mat> Sam::getMasks(const EmbeddingHandle& embedding,
+                                   const std::vector<Prompt>& prompts,
+                                   std::vector<double>* ious) const {
+    return getMasks(embedding, prompts, MaskOptions(), ious);
+}
+
+std::vector<cv::Mat> Sam::getMasks(const EmbeddingHandle& embedding,
+                                   const std::vector<Prompt>& prompts, const MaskOptions& options,
+                                   std::vector<double>* ious,
+                                   std::vector<cv::Rect>* regions) const {
+    if (!embedding || !m_model->hasDecoder()) {
+        fail(embedding ? Status::NoDecoder : Status::NoEmbedding,
+             embedding ? "Decoder not loaded" : "No image loaded");
+        return {};
+    }
+    std::vector<double> iouValues;
+    std::vector<cv::Mat> masks;
+    if (!guarded([&]() {
+            m_model->getMasks(*embedding, prompts, options, masks, iouValues, regions);
+        })) {
+        return {};
+    }
+    if (ious != nullptr) {
+        *ious = std::move(iouValues);
+    }
+    return masks;
+}
+
+std::vector<cv::Mat> Sam::getLowResMasks(const EmbeddingHandle& embedding,
+                                         const std::vector<Prompt>& prompts,
+                                         std::vector<double>* ious) const {
+    MaskOptions options;
+    options.output = MaskOutput::LowResLogits;
+    return getMasks(embedding, prompts, options, ious);
+}
+
+bool Sam::getLowResMaskCandidates(const EmbeddingHandle& embedding,
+                                  const std::vector<Prompt>& prompts,
+                                  std::vector<std::vector<cv::Mat>>& masks,
+                                  std::vector<std::vector<double>>& ious) const {
+    if (!embedding || !m_model->hasDecoder()) {
+        fail(embedding ? Status::NoDecoder : Status::NoEmbedding,
+             embedding ? "Decoder not loaded" : "No image loaded");
+        return false;
+    }
+    MaskOptions options;
+    options.output = MaskOutput::LowResLogits;
+    std::vector<cv::Mat> candidateMasks;
+    std::vector<double> candidateIous;
+    size_t candidates = 0;
+    if (!guarded([&]() {
+            m_model->getMasks(*embedding, prompts, options, candidateMasks, candidateIous,
+                              nullptr, &candidates);
+        })) {
+        return false;
+    }
+    masks.resize(prompts.size());
+    ious.resize(prompts.size());
+    for (size_t i = 0; i < prompts.size(); i++) {
+        masks[i].assign(candidateMasks.begin() + i * candidates,
+                        candidateMasks.begin() + (i + 1) * candidates);
+        ious[i].assign(candidateIous.begin() + i * candidates,
+                       candidateIous.begin() + (i + 1) * candidates);
+    }
+    return true;
+}
+
+cv::Mat Sam::upscaleMask(const EmbeddingHandle& embedding, const cv::Mat& lowResLogits,
+                         float threshold) const {
+    if (!embedding) {
+        fail(Status::NoEmbedding, "No image loaded");
+        return cv::Mat();
+    }
+    if (lowResLogits.type() != CV_32FC1 || !lowResLogits.isContinuous()) {
+        fail(Status::InvalidArgument, "Low resolution mask is not continuous CV_32FC1 logits");
+        return cv::Mat();
+    }
+    cv::Mat m;
+    PostprocessScratch scratch;
+    m_model->postprocessMask(lowResLogits.ptr<float>(), lowResLogits.size(), embedding->transform,
+                             m, scratch, threshold);
     return m;
 }
+
+Sam::PoolStats Sam::poolStats() { return BufferPool::shared().stats(); }
+
+void Sam::setPoolLimit(size_t bytes) { BufferPool::shared().setLimit(bytes); }
+
+Sam::Metrics Sam::metrics() const {
+    Metrics metrics;
+    const auto* counters = m_model->instrumentation.counters.get();
+    if (!counters) return metrics;
+    for (int i = 0; i < 4; i++) {
+        metrics.stages[i].count = counters->stageCount[i].load(std::memory_order_relaxed);
+        metrics.stages[i].totalMilliseconds =
+            counters->stageTotalNs[i].load(std::memory_order_relaxed) / 1e6;
+        metrics.stages[i].maxMilliseconds =
+            counters->stageMaxNs[i].load(std::memory_order_relaxed) / 1e6;
+    }
+    metrics.cacheHits = counters->cacheHits.load(std::memory_order_relaxed);
+    metrics.cacheMisses = counters->cacheMisses.load(std::memory_order_relaxed);
+    metrics.allocations = counters->allocations.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+std::string Sam::metricsPrometheus() const {
+    static const char* stageNames[]{"preprocess", "encoder_run", "decoder_run", "postprocess"};
+    const auto m = metrics();
+    std::ostringstream text;
+    text << "# HELP edgesam_stage_seconds Time spent in each encode / decode stage\n"
+         << "# TYPE edgesam_stage_seconds summary\n";
+    for (int i = 0; i < 4; i++) {
+        text << "edgesam_stage_seconds_sum{stage=\"" << stageNames[i] << "\"} "
+             << m.stages[i].totalMilliseconds / 1000 << "\n"
+             << "edgesam_stage_seconds_count{stage=\"" << stageNames[i] << "\"} "
+             << m.stages[i].count << "\n";
+    }
+    text << "# HELP edgesam_stage_max_seconds Longest run of each stage\n"
+         << "# TYPE edgesam_stage_max_seconds gauge\n";
+    for (int i = 0; i < 4; i++) {
+        text << "edgesam_stage_max_seconds{stage=\"" << stageNames[i] << "\"} "
+             << m.stages[i].maxMilliseconds / 1000 << "\n";
+    }
+    text << "# HELP edgesam_embedding_cache_hits_total Embedding cache hits\n"
+         << "# TYPE edgesam_embedding_cache_hits_total counter\n"
+         << "edgesam_embedding_cache_hits_total " << m.cacheHits << "\n"
+         << "# HELP edgesam_embedding_cache_misses_total Embedding cache misses\n"
+         << "# TYPE edgesam_embedding_cache_misses_total counter\n"
+         << "edgesam_embedding_cache_misses_total " << m.cacheMisses << "\n"
+         << "# HELP edgesam_allocations_total Buffers created while encoding / decoding\n"
+         << "# TYPE edgesam_allocations_total counter\n"
+         << "edgesam_allocations_total " << m.allocations << "\n";
+    const auto pool = poolStats();
+    text << "# HELP edgesam_pool_bytes Bytes held by the buffer pool shared by all instances\n"
+         << "# TYPE edgesam_pool_bytes gauge\n"
+         << "edgesam_pool_bytes{state=\"in_use\"} " << pool.inUseBytes << "\n"
+         << "edgesam_pool_bytes{state=\"cached\"} " << pool.cachedBytes << "\n"
+         << "# HELP edgesam_pool_peak_bytes Peak of the bytes held by the buffer pool\n"
+         << "# TYPE edgesam_pool_peak_bytes gauge\n"
+         << "edgesam_pool_peak_bytes " << pool.peakResidentBytes << "\n";
+    return text.str();
+}
+
+void Sam::resetMetrics() {
+    if (m_model->instrumentation.counters) m_model->instrumentation.counters->reset();
+}
+
+std::vector<std::string> Sam::endProfiling() {
+    std::vector<std::string> files;
+    if (!m_model->profiling.exchange(false)) return files;
+    Ort::AllocatorWithDefaultOptions allocator;
+    // joins a lazy decoder load
+    const bool decoder = m_model->hasDecoder();
+    for (auto* session :
+         {m_model->sessionPre.get(), decoder ? m_model->sessionSam.get() : nullptr}) {
+        if (session) files.push_back(session->EndProfilingAllocated(allocator).get());
+    }
+    return files;
+}
@@ -1,25 +1,150 @@
 #ifndef SAMCPP__SAM_H_
 #define SAMCPP__SAM_H_
 
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <list>
+#include <memory>
 #include <opencv2/core.hpp>
 #include <string>
+#include <vector>
 
 struct SamModel;
+struct DecodeState;
 
+// Thread safety: after construction every method may be called concurrently. Decoding against
+// an embedding is lock free apart from the pooled decoder state, a DecodeContext is used by one
+// thread at a time.
 class Sam {
     SamModel* m_model{nullptr};
 
 public:
+    enum class Stage { Preprocess, EncoderRun, DecoderRun, Postprocess };
+    // Receives the duration of every stage of encode / decode calls, on the thread running it
+    using StageObserver = std::function<void(Stage stage, double milliseconds)>;
+
+    // Why a call failed, see loadStatus() and lastError()
+    enum class Status {
+        Ok,
+        ModelNotFound,     // a model file does not exist, or no model was given
+        InvalidModel,      // a model failed to load or has unexpected inputs / outputs
+        NoEncoder,         // the call needs an encoder this instance does not have
+        NoDecoder,         // the call needs a decoder this instance does not have
+        InvalidImage,      // empty or not a 3-channel 8-bit image
+        NoEmbedding,       // no image loaded, or a null embedding handle
+        InvalidEmbedding,  // embedding file unreadable, corrupt or made for another model
+        InvalidArgument,
+        IoError,
+        RuntimeError,  // onnxruntime failed while running a model
+    };
+    static const char* statusMessage(Status status);
+
+    // Decoder export a model was recognized as, from its input / output names
+    enum class ModelFamily {
+        // image_embeddings, point_coords, point_labels [, mask_input, has_mask_input] -> scores,
+        // masks
+        EdgeSam,
+        // official SAM / MobileSAM export: the EdgeSam inputs with the mask pair and
+        // orig_im_size -> masks, iou_predictions, low_res_masks
+        Sam,
+    };
+
+    // How host embeddings keep their values, see Parameter::embeddingStorage
+    enum class EmbeddingStorage {
+        Float32,
+        Float16,  // half the memory of Float32
+        Int8,     // a quarter: symmetric int8 with one scale per channel
+    };
+
+    // Counters kept with Parameter::collectMetrics, all zero without it
+    struct Metrics {
+        struct StageStats {
+            uint64_t count{0};  // for EncoderRun / DecoderRun the number of model runs
+            double totalMilliseconds{0}, maxMilliseconds{0};
+        };
+        StageStats stages[4];                   // indexed by Stage
+        uint64_t cacheHits{0}, cacheMisses{0};  // embedding cache lookups
+        // buffers created while encoding / decoding: embeddings, encoder inputs, decoder states
+        // and decoder outputs. Steady state decoding through a DecodeContext adds none.
+        uint64_t allocations{0};
+    };
+
+    // Buffer pool shared by all instances: embeddings, encoder batches and masks take their
+    // memory from it and return it on release, see poolStats()
+    struct PoolStats {
+        size_t inUseBytes{0};     // leased out: live embeddings, masks and running batches
+        size_t cachedBytes{0};    // free buffers kept for reuse
+        size_t residentBytes{0};  // inUseBytes + cachedBytes
+        size_t peakResidentBytes{0};
+        uint64_t hits{0}, misses{0};  // requests served from a free list / from the heap
+    };
+
     struct Parameter {
         struct Provider {
-            // deviceType: 0 - CPU, 1 - CUDA
+            // deviceType: 0 - CPU, 1 - CUDA, 2 - TensorRT, 3 - XNNPACK, 4 - CoreML
             int gpuDeviceId{0}, deviceType{0};
-            size_t gpuMemoryLimit{0};
+            size_t gpuMemoryLimit{0};  // 0 - no limit
         };
         Provider providers[2];  // 0 - embedding, 1 - segmentation
-        std::string models[2];  // 0 - embedding, 1 - segmentation
-        int threadsNumber{1};
+        // 0 - embedding, 1 - segmentation; either may be empty for an encoder-only or
+        // decoder-only instance
+        std::string models[2];
+        int threadsNumber{1};       // intra-op threads, 0 - let onnxruntime decide
+        int interOpThreadsNumber{1};
+        // graphOptimizationLevel: 0 - disabled, 1 - basic, 2 - extended, 3 - all
+        int graphOptimizationLevel{3};
+        size_t embeddingCacheBytes{0};  // byte budget of the embedding cache, 0 - disabled
+        // storage of the embeddings encode / encodeBatch / loadEmbedding return, and so of the
+        // cached ones: compressed embeddings fit 2 - 4x more images in the same memory and are
+        // expanded into the decoder input once per embedding and decode context. Int8 costs a
+        // little mask accuracy. Ignored with deviceIo.
+        EmbeddingStorage embeddingStorage{EmbeddingStorage::Float32};
+        // prompts per decoder Run in getMasks, used when the decoder has a dynamic batch axis
+        int maxDecoderBatch{64};
+        // images of another size are resized keeping their aspect ratio and padded, to the top
+        // left corner of the input frame like SAM, or centered
+        bool centerLetterbox{false};
+        // encodes waiting for the encodeAsync / loadImageAsync worker before callers block
+        int encodeQueueSize{2};
+        // encode() calls running at the same time, each holds its own input buffer; further
+        // callers wait for one to finish
+        int maxConcurrentEncodes{1};
+        // images per encoder Run in encodeBatch, used when the encoder has a dynamic batch axis
+        int maxEncoderBatch{8};
+        StageObserver stageObserver;  // optional, for benchmarks and metrics
+        // keep the metrics() counters; off, instrumented code only tests for the observer
+        bool collectMetrics{false};
+        // Serialized models used instead of the files in models, e.g. embedded in the binary
+        // or memory mapped. They must stay valid until the constructor returns, with lazyDecoder
+        // until the decoder is loaded.
+        struct ModelBuffer {
+            const void* data{nullptr};
+            size_t size{0};
+        };
+        ModelBuffer modelBuffers[2];
+        // directory caching each model's optimized graph, keyed by model content, provider
+        // settings, threads and optimization level; later starts load it without optimizing
+        // again. Level 3 graphs may hold hardware specific kernels, use level 2 when machines
+        // share the cache. Not used with TensorRT, XNNPACK and CoreML, whose compiled graphs
+        // cannot be saved.
+        std::string optimizedModelDir;
+        // return from the constructor once the encoder is loaded; the decoder session (always
+        // built in parallel with the encoder one) keeps loading and the first decoding call
+        // waits for it. Decoder load failures then show up on that call.
+        bool lazyDecoder{false};
+        // one encoder and one decoder run on blank inputs while loading, so the first real call
+        // does not pay for onnxruntime's lazy initialization; counted in metrics()
+        bool warmup{false};
+        // onnxruntime profiling: when set, each session writes a chrome trace file starting with
+        // this prefix (_encoder / _decoder appended), finished by endProfiling()
+        std::string profilingPrefix;
+        // CUDA / TensorRT on both models with one gpuDeviceId: embeddings stay in device memory
+        // from the encoder output to the decoder input instead of a round trip through the host,
+        // and getDeviceMasks can leave the decoder masks there. Device embeddings have no host
+        // data (saveEmbedding rejects them) and need the encoder output and the decoder input
+        // of the same type. Ignored with other providers.
+        bool deviceIo{false};
         Parameter(const std::string& preModelPath, const std::string& samModelPath,
                   int threadsNumber) {
             models[0] = preModelPath;
@@ -27,18 +152,233 @@ public:
             this->threadsNumber = threadsNumber;
         }
     };
+    // Maps source image coordinates to the getInputSize() frame the models work in
+    struct ImageTransform {
+        cv::Size sourceSize, resizedSize, inputSize;
+        double scale{1.0};
+        cv::Point offset;  // top left corner of the resized image in the input frame
+
+        cv::Point2f toInput(const cv::Point2f& p) const {
+            return cv::Point2f((float)(p.x * scale + offset.x), (float)(p.y * scale + offset.y));
+        }
+        cv::Point2f toSource(const cv::Point2f& p) const {
+            return cv::Point2f((float)((p.x - offset.x) / scale),
+                               (float)((p.y - offset.y) / scale));
+        }
+        cv::Rect inputRect() const { return cv::Rect(offset, resizedSize); }
+    };
+
+    // Output of the embedding model for one image, immutable once created
+    struct Embedding {
+        std::vector<int64_t> shape;
+        std::vector<float> values;  // owned data, empty when the data lives in external
+        // data kept alive by owner, e.g. a memory mapped embedding file
+        const float* external{nullptr};
+        std::shared_ptr<const void> owner;
+        // Float16 / Int8 storage: the compressed values, kept alive by owner; data() is then null
+        EmbeddingStorage storage{EmbeddingStorage::Float32};
+        const void* compressed{nullptr};
+        std::vector<float> scales;  // Int8: per channel, value = scale * stored value
+        // Parameter::deviceIo: the encoder output tensor in device memory, data() is then null
+        std::shared_ptr<const void> device;
+        uint64_t key{0};  // content hash of the source image, 0 - not hashed
+        ImageTransform transform;
+
+        bool onDevice() const { return device != nullptr; }
+        bool isCompressed() const { return storage != EmbeddingStorage::Float32; }
+        const float* data() const {
+            return external ? external : values.empty() ? nullptr : values.data();
+        }
+        size_t size() const {
+            size_t n = 1;
+            for (auto d : shape) n *= (size_t)d;
+            return n;
+        }
+        // bytes of the stored values
+        size_t byteSize() const {
+            const size_t elementSize = storage == EmbeddingStorage::Float16 ? 2
+                                       : storage == EmbeddingStorage::Int8  ? 1
+                                                                            : sizeof(float);
+            return size() * elementSize + scales.size() * sizeof(float);
+        }
+    };
+    using EmbeddingHandle = std::shared_ptr<const Embedding>;
+
+    struct Prompt {
+        std::list<cv::Point> points, negativePoints;
+        cv::Rect roi;
+    };
+
+    enum class MaskOutput {
+        Binary,        // CV_8UC1 0 / 255 at source resolution
+        Probability,   // CV_32FC1 sigmoid of the logits at source resolution
+        LowResLogits,  // CV_32FC1 raw decoder logits, covering the whole input frame
+        // CV_8UC1 0 / 255 covering only the prompt roi grown by roiPadding (Binary without a
+        // roi); cost and memory scale with the roi, not the frame
+        BoxCropped,
+        // CV_8UC1 0 / 255 covering only the mask's bounding box (the box output of getMask),
+        // empty for an empty mask; encodeRle(mask, box, size) turns it into full frame RLE
+        MaskCropped,
+    };
+    struct MaskOptions {
+        MaskOutput output{MaskOutput::Binary};
+        float threshold{0.f};  // logit threshold of the binary outputs and of the bounding box
+        // return the candidate with the best predicted IoU instead of the first one
+        bool bestCandidate{false};
+        // refine the previous mask decoded through the same context and embedding, for decoders
+        // exported with mask_input / has_mask_input (ignored by the others)
+        bool refine{false};
+        // BoxCropped: source pixels the roi is grown by on every side, so masks reaching a bit
+        // past the prompt box are kept whole
+        int roiPadding{0};
+    };
+
+    // Reusable decoder state for one caller (e.g. one interactive session): prompt storage and
+    // decoder inputs/outputs are allocated and bound once, so repeated getMask calls through the
+    // same context and output Mat do not allocate
+    class DecodeContext {
+        DecodeState* m_state{nullptr};
+        friend class Sam;
+
+    public:
+        // maxPoints: initial prompt point capacity, grown on demand. deviceOutput: a context
+        // for getDeviceMasks only, the other decoding calls reject it.
+        explicit DecodeContext(const Sam& sam, size_t maxPoints = 16, bool deviceOutput = false);
+        ~DecodeContext();
+        // forgets the mask kept for refinement, the next decode starts over
+        void reset();
+        DecodeContext(const DecodeContext&) = delete;
+        DecodeContext& operator=(const DecodeContext&) = delete;
+    };
+
     // constructor
     Sam(const Parameter& param);
     ~Sam();
 
+    // false when a given model failed to load, loadStatus() tells why
+    bool isLoaded() const;
+    Status loadStatus() const;
+    // Reason of the latest failed call (false, nullptr or empty result) on the calling thread.
+    // Like errno it is not reset by successful calls.
+    static Status lastError();
+    // (0, 0) without an encoder
     cv::Size getInputSize() const;
+    // ModelFamily::EdgeSam without a decoder
+    ModelFamily modelFamily() const;
+    // Images of any size are accepted. Prompt coordinates are given in, and masks returned at,
+    // the resolution of the loaded image.
     bool loadImage(const cv::Mat& image);
+    // Runs the embedding model, or returns the cached embedding of an identical image.
+    // Returns nullptr on failure.
+    EmbeddingHandle encode(const cv::Mat& image);
+    // Embeddings of many images in image order, nullptr for the ones that failed. Encoders with a
+    // dynamic batch axis take maxEncoderBatch images per Run, others one; either way the next
+    // batch is preprocessed while the encoder runs. statuses, when given, receives why each image
+    // failed (Ok for the encoded ones); lastError() only tells the last failure.
+    std::vector<EmbeddingHandle> encodeBatch(const std::vector<cv::Mat>& images,
+                                             std::vector<Status>* statuses = nullptr);
+    void clearEmbeddingCache();
+
+    // Writes an embedding file: header (shape, dtype, encoder model hash, image transform) and
+    // 64 byte aligned data, as fp16 with fp16 set, otherwise in the embedding's storage
+    bool saveEmbedding(const EmbeddingHandle& embedding, const std::string& path,
+                       bool fp16 = false) const;
+    // Reads a file written by saveEmbedding, into Parameter::embeddingStorage. fp32 files kept
+    // as fp32 are memory mapped and used in place, without a copy. Files from another encoder
+    // model than the loaded one (when there is one) or with a shape the decoder does not take
+    // are rejected. Returns nullptr on failure.
+    EmbeddingHandle loadEmbedding(const std::string& path) const;
+    // Hash of the encoder model file stored in embedding files, 0 without an encoder
+    uint64_t encoderHash() const;
+    // encode() on a background worker, so decoding can go on while the next image is encoded.
+    // The image is copied; once encodeQueueSize encodes are pending, calls block until the
+    // worker takes one. The future yields nullptr on failure.
+    std::future<EmbeddingHandle> encodeAsync(const cv::Mat& image);
+    // encodeAsync that also makes the embedding the loaded image when it is ready
+    std::future<EmbeddingHandle> loadImageAsync(const cv::Mat& image);
 
     cv::Mat getMask(const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
                     const cv::Rect& roi, double* iou = nullptr) const;
     cv::Mat getMask(const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
                     double* iou = nullptr) const;
     cv::Mat getMask(const cv::Point& point, double* iou = nullptr) const;
+    // Same as above, against an embedding returned by encode() instead of the loaded image
+    cv::Mat getMask(const EmbeddingHandle& embedding, const std::list<cv::Point>& points,
+                    const std::list<cv::Point>& negativePoints, const cv::Rect& roi,
+                    double* iou = nullptr) const;
+
+    // Decodes into mask, reusing its buffer when it already has the right size and type
+    bool getMask(DecodeContext& context, const EmbeddingHandle& embedding,
+                 const std::list<cv::Point>& points, const std::list<cv::Point>& negativePoints,
+                 const cv::Rect& roi, cv::Mat& mask, double* iou = nullptr) const;
+
+    // Decodes in the requested output mode. box, when given, receives the bounding box of the
+    // mask in source coordinates, taken from the low resolution mask so it needs no upsampling.
+    // region receives the source rectangle the mask covers: its offset and size for the cropped
+    // outputs, the whole image for the others (LowResLogits: the input frame).
+    bool getMask(DecodeContext& context, const EmbeddingHandle& embedding, const Prompt& prompt,
+                 const MaskOptions& options, cv::Mat& mask, double* iou = nullptr,
+                 cv::Rect* box = nullptr, cv::Rect* region = nullptr) const;
+
+    // Low resolution mask logits of every candidate left in device memory by the decoder
+    // (Parameter::deviceIo), for consumers staying on the GPU such as a CUDA compositor. They are
+    // laid out [1, candidates, h, w] like getLowResMasks, covering the input frame. Each call
+    // returns a new buffer, valid while owner is held.
+    struct DeviceMasks {
+        const void* data{nullptr};
+        std::vector<int64_t> shape;
+        bool fp16{false};  // elements are half floats instead of floats
+        int deviceId{0};
+        std::shared_ptr<const void> owner;
+    };
+    // Decodes through a deviceOutput context. ious receives the predicted IoU of each candidate.
+    bool getDeviceMasks(DecodeContext& context, const EmbeddingHandle& embedding,
+                        const Prompt& prompt, DeviceMasks& masks,
+                        std::vector<double>* ious = nullptr) const;
+
+    // Every mask candidate of one decoder run with its predicted IoU, in decoder order
+    bool getMaskCandidates(DecodeContext& context, const EmbeddingHandle& embedding,
+                           const Prompt& prompt, const MaskOptions& options,
+                           std::vector<cv::Mat>& masks, std::vector<double>& ious) const;
+
+    // Decodes many prompts against one embedding, batching them into as few decoder runs as the
+    // model allows. Masks and ious are in prompt order.
+    std::vector<cv::Mat> getMasks(const std::vector<Prompt>& prompts,
+                                  std::vector<double>* ious = nullptr) const;
+    std::vector<cv::Mat> getMasks(const EmbeddingHandle& embedding,
+                                  const std::vector<Prompt>& prompts,
+                                  std::vector<double>* ious = nullptr) const;
+    // Batched decoding in any output mode (refine is ignored); with BoxCropped or MaskCropped
+    // regions receives the source rectangle each mask covers, see getMask
+    std::vector<cv::Mat> getMasks(const EmbeddingHandle& embedding,
+                                  const std::vector<Prompt>& prompts, const MaskOptions& options,
+                                  std::vector<double>* ious = nullptr,
+                                  std::vector<cv::Rect>* regions = nullptr) const;
+    // Same as getMasks but returns the decoder's low resolution mask logits (CV_32FC1), without
+    // upsampling or thresholding. They cover the whole input frame, padding included.
+    std::vector<cv::Mat> getLowResMasks(const EmbeddingHandle& embedding,
+                                        const std::vector<Prompt>& prompts,
+                                        std::vector<double>* ious = nullptr) const;
+    // getLowResMasks keeping every candidate of each prompt: masks[i] and ious[i] hold the
+    // candidates of prompts[i] in decoder order
+    bool getLowResMaskCandidates(const EmbeddingHandle& embedding,
+                                 const std::vector<Prompt>& prompts,
+                                 std::vector<std::vector<cv::Mat>>& masks,
+                                 std::vector<std::vector<double>>& ious) const;
+    // Binary CV_8UC1 mask at source resolution from getLowResMasks logits
+    cv::Mat upscaleMask(const EmbeddingHandle& embedding, const cv::Mat& lowResLogits,
+                        float threshold = 0.f) const;
+
+    static PoolStats poolStats();
+    // bytes of free buffers the pool keeps, 256 MB by default; 0 frees them all and pools nothing
+    static void setPoolLimit(size_t bytes);
+
+    Metrics metrics() const;
+    // metrics() in the Prometheus text exposition format
+    std::string metricsPrometheus() const;
+    void resetMetrics();
+    // Stops Parameter::profilingPrefix profiling and returns the written trace files
+    std::vector<std::string> endProfiling();
 };
 
 #endif  // SAMCPP__SAM_H_
@@ -0,0 +1,101 @@
+#include "embeddingCache.h"
+#include <cstring>
+
+static inline uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= 0xff51afd7ed558ccdull;
+    return h ^ (h >> 32);
+}
+
+uint64_t hashImage(const cv::Mat& image) {
+    // four independent lanes so the multiplies of consecutive words can overlap
+    uint64_t lanes[4]{0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+                      0x27d4eb2f165667c5ull};
+    lanes[0] = mix(lanes[0], (uint64_t)image.rows << 32 | (uint32_t)image.cols);
+    lanes[1] = mix(lanes[1], (uint64_t)image.type());
+
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int i = 0; i < image.rows; i++) {
+        const uchar* p = image.ptr(i);
+        size_t j = 0;
+        for (; j + 32 <= rowBytes; j += 32) {
+            uint64_t v[4];
+            memcpy(v, p + j, sizeof(v));
+            lanes[0] = mix(lanes[0], v[0]);
+            lanes[1] = mix(lanes[1], v[1]);
+            lanes[2] = mix(lanes[2], v[2]);
+            lanes[3] = mix(lanes[3], v[3]);
+        }
+        for (; j < rowBytes; j++) {
+            lanes[j & 3] = mix(lanes[j & 3], p[j]);
+        }
+    }
+
+    uint64_t h = lanes[0];
+    for (int i = 1; i < 4; i++) {
+        h = mix(h, lanes[i]);
+    }
+    return h;
+}
+
+Sam::EmbeddingHandle EmbeddingCache::find(uint64_t key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        m_misses++;
+        return nullptr;
+    }
+    m_hits++;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return *it->second;
+}
+
+void EmbeddingCache::insert(const Sam::EmbeddingHandle& embedding) {
+    if (!embedding || embedding->byteSize() > m_budget) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(embedding->key);
+    if (it != m_index.end()) {
+        m_bytes -= (*it->second)->byteSize();
+        m_entries.erase(it->second);
+    }
+    m_entries.push_front(embedding);
+    m_index[embedding->key] = m_entries.begin();
+    m_bytes += embedding->byteSize();
+    evict();
+}
+
+void EmbeddingCache::evict() {
+    while (m_bytes > m_budget && !m_entries.empty()) {
+        m_bytes -= m_entries.back()->byteSize();
+        m_index.erase(m_entries.back()->key);
+        m_entries.pop_back();
+    }
+}
+
+void EmbeddingCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
+
+size_t EmbeddingCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+size_t EmbeddingCache::bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+size_t EmbeddingCache::hits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+size_t EmbeddingCache::misses() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
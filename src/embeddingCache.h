@@ -0,0 +1,38 @@
+#ifndef SAMCPP__EMBEDDING_CACHE_H_
+#define SAMCPP__EMBEDDING_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "edgeSam.h"
+
+// Content hash of the pixels, size and type of an image, used as the embedding cache key
+uint64_t hashImage(const cv::Mat& image);
+
+// LRU cache of image embeddings with a byte budget, safe to share between threads
+class EmbeddingCache {
+    mutable std::mutex m_mutex;
+    std::list<Sam::EmbeddingHandle> m_entries;  // most recently used first
+    std::unordered_map<uint64_t, std::list<Sam::EmbeddingHandle>::iterator> m_index;
+    size_t m_budget{0}, m_bytes{0};
+    size_t m_hits{0}, m_misses{0};
+
+    void evict();  // with m_mutex held
+
+public:
+    explicit EmbeddingCache(size_t byteBudget) : m_budget(byteBudget) {}
+
+    // returns nullptr on a miss
+    Sam::EmbeddingHandle find(uint64_t key);
+    void insert(const Sam::EmbeddingHandle& embedding);
+    void clear();
+
+    size_t size() const;
+    size_t bytes() const;
+    size_t budget() const { return m_budget; }
+    size_t hits() const;
+    size_t misses() const;
+};
+
+#endif  // SAMCPP__EMBEDDING_CACHE_H_
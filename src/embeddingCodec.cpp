@@ -0,0 +1,70 @@
+#include "embeddingCodec.h"
+#include "bufferPool.h"
+
+// values per channel: the quantization granularity
+static size_t planeSize(const Sam::Embedding& embedding) {
+    return embedding.shape.size() == 4 ? (size_t)(embedding.shape[2] * embedding.shape[3])
+                                       : embedding.size();
+}
+
+void convertEmbedding(Sam::Embedding& embedding, Sam::EmbeddingStorage storage) {
+    using Storage = Sam::EmbeddingStorage;
+    if (embedding.storage == storage) return;
+    const int n = (int)embedding.size();
+    if (embedding.isCompressed()) {
+        // back to fp32 first; source shares the compressed data until it is expanded
+        const Sam::Embedding source = embedding;
+        embedding.storage = Storage::Float32;
+        embedding.compressed = nullptr;
+        embedding.scales.clear();
+        cv::Mat values(1, n, CV_32FC1, allocateEmbedding(embedding));
+        expandEmbedding(source, values, CV_32F);
+        if (storage == Storage::Float32) return;
+    }
+
+    const cv::Mat values(1, n, CV_32FC1, (void*)embedding.data());
+    auto buffer = BufferPool::shared().buffer(storage == Storage::Float16 ? 2 * (size_t)n : n);
+    if (storage == Storage::Float16) {
+        values.convertTo(cv::Mat(1, n, CV_16FC1, buffer.get()), CV_16F);
+    } else {
+        const size_t plane = planeSize(embedding);
+        auto* quantized = static_cast<int8_t*>(buffer.get());
+        embedding.scales.resize(embedding.size() / plane);
+        for (size_t c = 0; c < embedding.scales.size(); c++) {
+            const cv::Mat channel = values.colRange((int)(c * plane), (int)((c + 1) * plane));
+            const double maxAbs = cv::norm(channel, cv::NORM_INF);
+            const float scale = maxAbs > 0 ? (float)(maxAbs / 127) : 1.f;
+            channel.convertTo(cv::Mat(1, (int)plane, CV_8SC1, quantized + c * plane), CV_8S,
+                              1. / scale);
+            embedding.scales[c] = scale;
+        }
+    }
+    std::vector<float>().swap(embedding.values);
+    embedding.external = nullptr;
+    embedding.compressed = buffer.get();
+    embedding.owner = std::move(buffer);
+    embedding.storage = storage;
+}
+
+void expandEmbedding(const Sam::Embedding& embedding, cv::Mat& values, int depth) {
+    const int n = (int)embedding.size();
+    values.create(1, n, CV_MAKETYPE(depth, 1));
+    switch (embedding.storage) {
+        case Sam::EmbeddingStorage::Float32:
+            cv::Mat(1, n, CV_32FC1, (void*)embedding.data()).convertTo(values, depth);
+            break;
+        case Sam::EmbeddingStorage::Float16:
+            cv::Mat(1, n, CV_16FC1, (void*)embedding.compressed).convertTo(values, depth);
+            break;
+        case Sam::EmbeddingStorage::Int8: {
+            const size_t plane = planeSize(embedding);
+            const auto* quantized = static_cast<const int8_t*>(embedding.compressed);
+            for (size_t c = 0; c < embedding.scales.size(); c++) {
+                cv::Mat(1, (int)plane, CV_8SC1, (void*)(quantized + c * plane))
+                    .convertTo(values.colRange((int)(c * plane), (int)((c + 1) * plane)), depth,
+                               embedding.scales[c]);
+            }
+            break;
+        }
+    }
+}
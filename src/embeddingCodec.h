@@ -0,0 +1,16 @@
+#ifndef SAMCPP__EMBEDDING_CODEC_H_
+#define SAMCPP__EMBEDDING_CODEC_H_
+
+#include "edgeSam.h"
+
+// Compressed embedding storage, see Parameter::embeddingStorage. Int8 quantizes every channel
+// (plane of the [1, C, H, W] embedding) symmetrically with its own scale, max |value| / 127.
+// Conversions run through cv::Mat::convertTo, vectorized by OpenCV.
+
+// Stores embedding's values as storage in pooled memory, releasing the previous storage with
+// its owner. Host embeddings only.
+void convertEmbedding(Sam::Embedding& embedding, Sam::EmbeddingStorage storage);
+// embedding's values as a 1 x size() CV_32F or CV_16F (depth) Mat, created in values
+void expandEmbedding(const Sam::Embedding& embedding, cv::Mat& values, int depth);
+
+#endif  // SAMCPP__EMBEDDING_CODEC_H_
@@ -0,0 +1,225 @@
+#include "embeddingIO.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <vector>
+#include "bufferPool.h"
+#include "embeddingCache.h"
+#include "embeddingCodec.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kMagic[8]{'E', 'D', 'G', 'E', 'S', 'A', 'M', 'B'};
+static const uint32_t kVersion = 1;
+static const size_t kDataAlignment = 64;
+
+bool writeEmbeddingFile(const Sam::Embedding& embedding, const std::string& path,
+                        uint64_t modelHash, bool fp16) {
+    if (embedding.shape.size() != 4 || (!embedding.data() && !embedding.compressed)) {
+        std::cerr << "Invalid embedding" << std::endl;
+        return false;
+    }
+
+    EmbeddingFileHeader header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    const auto storage = fp16 ? Sam::EmbeddingStorage::Float16 : embedding.storage;
+    header.dtype = storage == Sam::EmbeddingStorage::Float16 ? kEmbeddingFp16
+                   : storage == Sam::EmbeddingStorage::Int8  ? kEmbeddingInt8
+                                                             : kEmbeddingFp32;
+    header.modelHash = modelHash;
+    header.key = embedding.key;
+    for (int i = 0; i < 4; i++) {
+        header.shape[i] = embedding.shape[i];
+    }
+    const auto& t = embedding.transform;
+    const cv::Size sizes[]{t.sourceSize, t.resizedSize, t.inputSize};
+    int32_t* fields[]{header.sourceSize, header.resizedSize, header.inputSize};
+    for (int i = 0; i < 3; i++) {
+        fields[i][0] = sizes[i].width;
+        fields[i][1] = sizes[i].height;
+    }
+    header.offset[0] = t.offset.x;
+    header.offset[1] = t.offset.y;
+    header.scale = t.scale;
+    header.dataOffset = (sizeof(header) + kDataAlignment - 1) / kDataAlignment * kDataAlignment;
+
+    // stored values are written as they are, an fp16 file of other storage takes a converted copy
+    const void* data = embedding.isCompressed() ? embedding.compressed : embedding.data();
+    cv::Mat half;
+    if (storage != embedding.storage) {
+        expandEmbedding(embedding, half, CV_16F);
+        data = half.data;
+    }
+    const size_t valueBytes =
+        embedding.size() * (storage == Sam::EmbeddingStorage::Int8    ? 1
+                            : storage == Sam::EmbeddingStorage::Float16 ? 2
+                                                                        : sizeof(float));
+    const size_t scaleBytes =
+        storage == Sam::EmbeddingStorage::Int8 ? embedding.scales.size() * sizeof(float) : 0;
+    header.dataBytes = valueBytes + scaleBytes;
+
+    std::ofstream f(path, std::ios::binary);
+    if (!f.good()) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    const char padding[kDataAlignment]{};
+    f.write((const char*)&header, sizeof(header));
+    f.write(padding, header.dataOffset - sizeof(header));
+    f.write((const char*)data, valueBytes);
+    f.write((const char*)embedding.scales.data(), scaleBytes);
+    return f.good();
+}
+
+static bool checkHeader(const EmbeddingFileHeader& header, uint64_t fileSize) {
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+        std::cerr << "Not an embedding file (or an unsupported version)" << std::endl;
+        return false;
+    }
+    if (header.dtype != kEmbeddingFp32 && header.dtype != kEmbeddingFp16 &&
+        header.dtype != kEmbeddingInt8) {
+        std::cerr << "Unknown embedding dtype " << header.dtype << std::endl;
+        return false;
+    }
+    uint64_t count = 1;
+    for (auto d : header.shape) {
+        if (d <= 0) {
+            std::cerr << "Invalid embedding shape" << std::endl;
+            return false;
+        }
+        count *= d;
+    }
+    if (header.sourceSize[0] <= 0 || header.sourceSize[1] <= 0 || header.inputSize[0] <= 0 ||
+        header.inputSize[1] <= 0 || !(header.scale > 0)) {
+        std::cerr << "Invalid embedding image transform" << std::endl;
+        return false;
+    }
+    const uint64_t elemSize = header.dtype == kEmbeddingFp16  ? 2
+                              : header.dtype == kEmbeddingInt8 ? 1
+                                                               : 4;
+    const uint64_t scaleBytes =
+        header.dtype == kEmbeddingInt8 ? header.shape[0] * header.shape[1] * sizeof(float) : 0;
+    if (header.dataBytes != count * elemSize + scaleBytes ||
+        header.dataOffset % kDataAlignment != 0 || header.dataOffset < sizeof(header) ||
+        header.dataOffset + header.dataBytes > fileSize) {
+        std::cerr << "Truncated or corrupt embedding file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void applyHeader(const EmbeddingFileHeader& header, Sam::Embedding& embedding) {
+    embedding.shape.assign(header.shape, header.shape + 4);
+    embedding.key = header.key;
+    auto& t = embedding.transform;
+    t.sourceSize = cv::Size(header.sourceSize[0], header.sourceSize[1]);
+    t.resizedSize = cv::Size(header.resizedSize[0], header.resizedSize[1]);
+    t.inputSize = cv::Size(header.inputSize[0], header.inputSize[1]);
+    t.offset = cv::Point(header.offset[0], header.offset[1]);
+    t.scale = header.scale;
+}
+
+Sam::EmbeddingHandle readEmbeddingFile(const std::string& path, uint64_t* modelHash,
+                                       Sam::EmbeddingStorage storage) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (!f.good()) {
+        std::cerr << "Embedding file " << path << " not found" << std::endl;
+        return nullptr;
+    }
+    const uint64_t fileSize = f.tellg();
+    EmbeddingFileHeader header{};
+    f.seekg(0);
+    if (fileSize < sizeof(header) || !f.read((char*)&header, sizeof(header)) ||
+        !checkHeader(header, fileSize)) {
+        return nullptr;
+    }
+    if (modelHash != nullptr) {
+        *modelHash = header.modelHash;
+    }
+
+    auto embedding = std::make_shared<Sam::Embedding>();
+    applyHeader(header, *embedding);
+
+#ifndef _WIN32
+    if (header.dtype == kEmbeddingFp32) {
+        // zero copy: the decoder reads the embedding straight from the page cache
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped != MAP_FAILED) {
+                embedding->owner = std::shared_ptr<const void>(
+                    mapped, [fileSize](const void* p) { munmap((void*)p, fileSize); });
+                embedding->external =
+                    reinterpret_cast<const float*>((const char*)mapped + header.dataOffset);
+                convertEmbedding(*embedding, storage);
+                return embedding;
+            }
+        }
+    }
+#endif
+
+    // fp32 data is read straight into the pooled embedding, compressed data into pooled
+    // storage of its own type, then converted when storage differs
+    char* data;
+    if (header.dtype == kEmbeddingFp32) {
+        data = (char*)allocateEmbedding(*embedding);
+    } else {
+        auto buffer = BufferPool::shared().buffer(header.dataBytes);
+        data = static_cast<char*>(buffer.get());
+        embedding->storage = header.dtype == kEmbeddingFp16 ? Sam::EmbeddingStorage::Float16
+                                                            : Sam::EmbeddingStorage::Int8;
+        embedding->compressed = data;
+        embedding->owner = std::move(buffer);
+    }
+    f.seekg(header.dataOffset);
+    if (!f.read(data, header.dataBytes)) {
+        std::cerr << "Cannot read " << path << std::endl;
+        return nullptr;
+    }
+    if (header.dtype == kEmbeddingInt8) {
+        const size_t channels = header.shape[0] * header.shape[1];
+        const auto* scales = reinterpret_cast<const float*>(data + embedding->size());
+        embedding->scales.assign(scales, scales + channels);
+    }
+    convertEmbedding(*embedding, storage);
+    return embedding;
+}
+
+static const size_t kHashChunk = 1 << 20;
+static const uint64_t kHashSeed = 0x9e3779b97f4a7c15ull;
+
+// folds one chunk of at most kHashChunk bytes into h
+static uint64_t hashChunk(uint64_t h, const void* data, size_t n) {
+    return (h ^ hashImage(cv::Mat(1, (int)n, CV_8UC1, (void*)data))) * 0xff51afd7ed558ccdull;
+}
+
+uint64_t hashFile(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.good()) return 0;
+    std::vector<char> chunk(kHashChunk);
+    uint64_t h = kHashSeed;
+    while (f) {
+        f.read(chunk.data(), chunk.size());
+        const auto n = f.gcount();
+        if (n <= 0) break;
+        h = hashChunk(h, chunk.data(), n);
+    }
+    return h;
+}
+
+uint64_t hashBytes(const void* data, size_t size) {
+    uint64_t h = kHashSeed;
+    for (size_t offset = 0; offset < size; offset += kHashChunk) {
+        h = hashChunk(h, (const char*)data + offset, std::min(kHashChunk, size - offset));
+    }
+    return h;
+}
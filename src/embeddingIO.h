@@ -0,0 +1,40 @@
+#ifndef SAMCPP__EMBEDDING_IO_H_
+#define SAMCPP__EMBEDDING_IO_H_
+
+#include <cstdint>
+#include <string>
+#include "edgeSam.h"
+
+// Embedding file layout, native byte order:
+//   EmbeddingFileHeader, zero padding up to dataOffset (a multiple of 64),
+//   then the embedding values (shape[0] * ... * shape[3]) as fp32, fp16 or int8; int8 values
+//   are followed by the fp32 scales of the shape[0] * shape[1] channels
+struct EmbeddingFileHeader {
+    char magic[8];  // "EDGESAMB"
+    uint32_t version, dtype;
+    uint64_t modelHash;  // hash of the encoder model that produced the embedding
+    uint64_t key;        // content hash of the source image, 0 - not hashed
+    int64_t shape[4];
+    int32_t sourceSize[2], resizedSize[2], inputSize[2], offset[2];
+    double scale;
+    uint64_t dataOffset, dataBytes;
+};
+
+enum EmbeddingDtype : uint32_t { kEmbeddingFp32 = 0, kEmbeddingFp16 = 1, kEmbeddingInt8 = 2 };
+
+// fp16, or the embedding's own storage without it
+bool writeEmbeddingFile(const Sam::Embedding& embedding, const std::string& path,
+                        uint64_t modelHash, bool fp16);
+// The embedding is returned in storage. fp32 data is memory mapped where the platform allows
+// it, data stored as it is kept is read without conversion.
+// Returns nullptr on failure, modelHash receives the hash stored in the file.
+Sam::EmbeddingHandle readEmbeddingFile(
+    const std::string& path, uint64_t* modelHash = nullptr,
+    Sam::EmbeddingStorage storage = Sam::EmbeddingStorage::Float32);
+
+// Hash of a file's contents, 0 if it cannot be read
+uint64_t hashFile(const std::string& path);
+// hashFile of a file holding these bytes
+uint64_t hashBytes(const void* data, size_t size);
+
+#endif  // SAMCPP__EMBEDDING_IO_H_
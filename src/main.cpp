@@ -1,55 +1,341 @@
+// edgeSamOrtCpp: segments images, directories or image lists with one set of sessions
+//
+//   edgeSamOrtCpp <image | directory | list.txt>... [--prompts prompts.json|prompts.csv]
+//                 [--output ../output] [--variant edge_sam|edge_sam_3x] [--models-dir ../models]
+//                 [--encoder path] [--decoder path] [--provider cpu|cuda|tensorrt|xnnpack|coreml]
+//                 [--threads n] [--decode-threads n] [--batch n] [--no-overlay]
+//
+// Prompts (coordinates in source image pixels), for the image with that file name or path, or
+// for every image without prompts of its own with "*":
+//   JSON: {"prompts": [{"image": "cat.jpg", "points": [x, y, ...], "negative": [x, y, ...],
+//                       "box": [x1, y1, x2, y2]}, ...]}
+//   CSV:  image,prompt,label,x,y per point; rows with the same image and prompt id form one
+//         prompt, labels as the decoder takes them: 1 - positive, 0 - negative, 2 / 3 - box
+//         top left / bottom right. A first line starting with "image" is skipped.
+// Without prompts every image is segmented with a full frame box. For each image <stem>_mask.png
+// (<stem>_mask<i>.png for several prompts) and <stem>_overlay.png are written to the output
+// directory, created when missing; images sharing a stem are written as <stem>_2, <stem>_3...
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
 #include <opencv2/opencv.hpp>
+#include <set>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
+#include "cliOptions.h"
 #include "edgeSam.h"
+#include "maskUtils.h"
+#include "workQueue.h"
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("Please, add an image!");
-        exit(0);
+struct Options {
+    std::vector<std::string> inputs;
+    std::string prompts, output{"../output"};
+    ModelOptions model;
+    int decodeThreads{std::max((int)std::thread::hardware_concurrency() / 2, 1)};
+    int batch{4};
+    bool overlay{true};
+};
+
+static bool parseArgs(int argc, char** argv, Options& options) {
+    auto option = [&](const std::string& arg, const std::string& value) {
+        if (arg == "--no-overlay") {
+            options.overlay = false;
+        } else if (arg == "--prompts") {
+            options.prompts = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else if (arg == "--decode-threads") {
+            options.decodeThreads = std::max(std::atoi(value.c_str()), 1);
+        } else if (arg == "--batch") {
+            options.batch = std::max(std::atoi(value.c_str()), 1);
+        } else {
+            return false;
+        }
+        return true;
+    };
+    if (!parseArgs(argc, argv, options.model, option, &options.inputs, {"--no-overlay"})) {
+        return false;
+    }
+    if (options.inputs.empty()) {
+        std::cerr << "Please, add an image, a directory or an image list" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::string extension(const std::string& path) {
+    const auto dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find_first_of("/\\", dot) != std::string::npos) return "";
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+static std::string fileName(const std::string& path) {
+    const auto slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string stem(const std::string& path) {
+    const std::string name = fileName(path);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+static bool isImageFile(const std::string& path) {
+    static const char* extensions[]{"jpg", "jpeg", "png", "bmp", "tif", "tiff", "webp"};
+    const std::string ext = extension(path);
+    return std::find(std::begin(extensions), std::end(extensions), ext) != std::end(extensions);
+}
+
+// Image paths of the inputs: directories are listed (sorted), .txt files hold one path per line
+static std::vector<std::string> collectImages(const std::vector<std::string>& inputs) {
+    std::vector<std::string> images;
+    for (auto& input : inputs) {
+        if (extension(input) == "txt") {
+            std::ifstream f(input);
+            if (!f.good()) std::cerr << "Cannot read " << input << std::endl;
+            std::string line;
+            while (std::getline(f, line)) {
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty()) images.push_back(line);
+            }
+        } else if (isImageFile(input)) {
+            images.push_back(input);
+        } else {
+            std::vector<std::string> files;
+            cv::glob(input + "/*", files, false);
+            std::sort(files.begin(), files.end());
+            for (auto& file : files) {
+                if (isImageFile(file)) images.push_back(file);
+            }
+        }
     }
+    return images;
+}
 
-    // Read Image Input
-    std::string imageFilePath = argv[1];
-    cv::Mat image = cv::imread(imageFilePath);
-    if (image.empty()) {
-        std::cout << "Image loading failed" << std::endl;
-        return -1;
+// Output file prefix of every image: its stem, made unique with _2, _3... in input order
+static std::vector<std::string> outputNames(const std::vector<std::string>& images) {
+    std::vector<std::string> names;
+    std::set<std::string> used;
+    for (auto& image : images) {
+        std::string name = stem(image);
+        for (int i = 2; !used.insert(name).second; i++) {
+            name = stem(image) + "_" + std::to_string(i);
+        }
+        names.push_back(name);
     }
+    return names;
+}
 
-    Sam::Parameter param("../models/edge_sam_3x_encoder.onnx", "../models/edge_sam_3x_decoder.onnx",
-                         std::thread::hardware_concurrency());
-    param.providers[0].deviceType = 0;
-    param.providers[1].deviceType = 0;
-    Sam sam(param);
+// Prompts by image file name or path, "*" - images without their own
+using PromptMap = std::map<std::string, std::vector<Sam::Prompt>>;
 
-    auto inputSize = sam.getInputSize();
-    if (inputSize.empty()) {
-        std::cout << "Sam initialization failed" << std::endl;
-        return -1;
+static std::vector<int> readNumbers(const cv::FileNode& node) {
+    std::vector<int> values;
+    for (const auto& value : node) {
+        values.push_back(cvRound((double)value));
     }
+    return values;
+}
 
-    std::cout << "Resize image to " << inputSize << std::endl;
-    cv::resize(image, image, inputSize);
-    if (!sam.loadImage(image)) {
-        std::cout << "Image loading failed" << std::endl;
-        return -1;
+static bool readJsonPrompts(const std::string& path, PromptMap& prompts) {
+    cv::FileStorage fs(path, cv::FileStorage::READ | cv::FileStorage::FORMAT_JSON);
+    if (!fs.isOpened() || !fs["prompts"].isSeq()) {
+        std::cerr << "Cannot read prompts from " << path << std::endl;
+        return false;
+    }
+    for (const auto& node : fs["prompts"]) {
+        Sam::Prompt prompt;
+        const auto points = readNumbers(node["points"]), negative = readNumbers(node["negative"]),
+                   box = readNumbers(node["box"]);
+        for (size_t i = 0; i + 1 < points.size(); i += 2) {
+            prompt.points.push_back(cv::Point(points[i], points[i + 1]));
+        }
+        for (size_t i = 0; i + 1 < negative.size(); i += 2) {
+            prompt.negativePoints.push_back(cv::Point(negative[i], negative[i + 1]));
+        }
+        if (box.size() == 4) {
+            prompt.roi = cv::Rect(cv::Point(box[0], box[1]), cv::Point(box[2], box[3]));
+        }
+        prompts[(std::string)node["image"]].push_back(prompt);
     }
+    return true;
+}
 
-    cv::Rect box{0, 0, 1024, 1024};
-    // std::list<cv::Point> points{cv::Point(512, 512)};
-    // std::list<cv::Point> negativePoints{cv::Point(5, 5),cv::Point(1019, 5)};
+static bool readCsvPrompts(const std::string& path, PromptMap& prompts) {
+    std::ifstream f(path);
+    if (!f.good()) {
+        std::cerr << "Cannot read prompts from " << path << std::endl;
+        return false;
+    }
+    // prompt id -> index in the prompts of its image
+    std::map<std::pair<std::string, std::string>, size_t> ids;
+    std::map<std::pair<std::string, std::string>, cv::Point> boxCorners;
+    std::string line;
+    for (int lineNumber = 1; std::getline(f, line); lineNumber++) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || (lineNumber == 1 && line.compare(0, 5, "image") == 0)) continue;
+        std::vector<std::string> fields;
+        std::stringstream row(line);
+        for (std::string field; std::getline(row, field, ',');) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 5) {
+            std::cerr << path << ":" << lineNumber << ": expected image,prompt,label,x,y"
+                      << std::endl;
+            return false;
+        }
+        const auto id = std::make_pair(fields[0], fields[1]);
+        auto& imagePrompts = prompts[fields[0]];
+        auto it = ids.find(id);
+        if (it == ids.end()) {
+            it = ids.emplace(id, imagePrompts.size()).first;
+            imagePrompts.emplace_back();
+        }
+        auto& prompt = imagePrompts[it->second];
+        const int label = std::atoi(fields[2].c_str());
+        const cv::Point point(std::atoi(fields[3].c_str()), std::atoi(fields[4].c_str()));
+        if (label == 1) {
+            prompt.points.push_back(point);
+        } else if (label == 0) {
+            prompt.negativePoints.push_back(point);
+        } else if (label == 2) {
+            boxCorners[id] = point;
+        } else if (label == 3 && boxCorners.count(id)) {
+            prompt.roi = cv::Rect(boxCorners[id], point);
+        }
+    }
+    return true;
+}
 
-    cv::Mat mask = sam.getMask({}, {}, box);
-    cv::imwrite("../output/mask.png", mask);
-    // apply mask to image
-    cv::Mat outImage = image.clone();
-    outImage = cv::Mat::zeros(image.size(), CV_8UC3);
-    for (int i = 0; i < image.rows; i++) {
-        for (int j = 0; j < image.cols; j++) {
-            auto bFront = mask.at<uchar>(i, j) > 0;
-            float factor = bFront ? 1.0 : 0.2;
-            outImage.at<cv::Vec3b>(i, j) = image.at<cv::Vec3b>(i, j) * factor;
+// Union of the masks over a darkened copy of image
+static cv::Mat overlay(const cv::Mat& image, const std::vector<cv::Mat>& masks) {
+    cv::Mat foreground = cv::Mat::zeros(image.size(), CV_8UC1);
+    for (auto& mask : masks) {
+        if (mask.size() == image.size()) cv::bitwise_or(foreground, mask, foreground);
+    }
+    cv::Mat out;
+    blendMask(image, foreground, out, cv::Scalar(), 0.0, 0.2);
+    return out;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseArgs(argc, argv, options)) return 1;
+
+    PromptMap prompts;
+    if (!options.prompts.empty()) {
+        const bool read = extension(options.prompts) == "csv"
+                              ? readCsvPrompts(options.prompts, prompts)
+                              : readJsonPrompts(options.prompts, prompts);
+        if (!read) return 1;
+    }
+    const auto images = collectImages(options.inputs);
+    if (images.empty()) {
+        std::cerr << "No images found" << std::endl;
+        return 1;
+    }
+    const auto names = outputNames(images);
+    std::error_code error;
+    std::filesystem::create_directories(options.output, error);
+    if (error) {
+        std::cerr << "Cannot create " << options.output << ": " << error.message() << std::endl;
+        return 1;
+    }
+
+    Sam::Parameter param(options.model.encoder, options.model.decoder, options.model.threads);
+    param.providers[0].deviceType = param.providers[1].deviceType = options.model.deviceType;
+    param.maxEncoderBatch = options.batch;
+    Sam sam(param);
+    if (!sam.isLoaded()) {
+        std::cerr << "Sam initialization failed: " << Sam::statusMessage(sam.loadStatus())
+                  << std::endl;
+        return 1;
+    }
+
+    // decode workers, each with its own context on the shared sessions, and one writer; their
+    // bounded queues keep reading and encoding from running far ahead
+    std::vector<std::unique_ptr<Sam::DecodeContext>> contexts;
+    std::vector<std::unique_ptr<WorkQueue>> decoders;
+    for (int i = 0; i < options.decodeThreads; i++) {
+        contexts.push_back(std::make_unique<Sam::DecodeContext>(sam));
+    }
+    auto writer = std::make_unique<WorkQueue>(4 * options.batch);
+    std::atomic<int> failed{0}, written{0};
+    auto write = [&](const std::string& path, const cv::Mat& image) {
+        writer->push([&, path, image]() {
+            if (cv::imwrite(path, image)) {
+                written++;
+            } else {
+                std::cerr << "Cannot write " << path << std::endl;
+                failed++;
+            }
+        });
+    };
+    for (int i = 0; i < options.decodeThreads; i++) {
+        decoders.push_back(std::make_unique<WorkQueue>(options.batch));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t nextDecoder = 0;
+    for (size_t first = 0; first < images.size(); first += options.batch) {
+        const size_t count = std::min((size_t)options.batch, images.size() - first);
+        std::vector<cv::Mat> batch(count);
+        cv::parallel_for_(cv::Range(0, (int)count), [&](const cv::Range& range) {
+            for (int j = range.start; j < range.end; j++) {
+                batch[j] = cv::imread(images[first + j]);
+            }
+        });
+        // decoding of this batch runs on the workers while the next one is read and encoded
+        std::vector<Sam::Status> statuses;
+        const auto embeddings = sam.encodeBatch(batch, &statuses);
+
+        for (size_t j = 0; j < count; j++) {
+            const std::string& path = images[first + j];
+            if (!embeddings[j]) {
+                std::cerr << "Image " << path << " failed: " << Sam::statusMessage(statuses[j])
+                          << std::endl;
+                failed++;
+                continue;
+            }
+            auto it = prompts.find(path);
+            if (it == prompts.end()) it = prompts.find(fileName(path));
+            if (it == prompts.end()) it = prompts.find("*");
+            std::vector<Sam::Prompt> imagePrompts{
+                Sam::Prompt{{}, {}, cv::Rect(cv::Point(), batch[j].size())}};
+            if (it != prompts.end()) imagePrompts = it->second;
+
+            const size_t worker = nextDecoder++ % decoders.size();
+            const std::string base = options.output + "/" + names[first + j];
+            decoders[worker]->push([&, worker, base, image = batch[j], embedding = embeddings[j],
+                                    imagePrompts]() {
+                std::vector<cv::Mat> masks(imagePrompts.size());
+                for (size_t k = 0; k < imagePrompts.size(); k++) {
+                    if (!sam.getMask(*contexts[worker], embedding, imagePrompts[k],
+                                     Sam::MaskOptions(), masks[k])) {
+                        failed++;
+                        continue;
+                    }
+                    write(base + "_mask" + (masks.size() > 1 ? std::to_string(k) : "") + ".png",
+                          masks[k]);
+                }
+                if (options.overlay) write(base + "_overlay.png", overlay(image, masks));
+            });
         }
     }
-    cv::imwrite("../output/overlayImgMask.png", outImage);
+    // finishes the queued jobs, decoders first as they push to the writer
+    decoders.clear();
+    writer.reset();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << images.size() << " images, " << written << " files written, " << failed
+              << " failures in " << elapsed.count() << " s" << std::endl;
+    return failed > 0 ? 1 : 0;
 }
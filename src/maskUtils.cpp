@@ -0,0 +1,113 @@
+#include "maskUtils.h"
+#include <cstring>
+#include <opencv2/imgproc.hpp>
+
+RleMask encodeRle(const cv::Mat& mask) {
+    return encodeRle(mask, cv::Rect(cv::Point(), mask.size()), mask.size());
+}
+
+RleMask encodeRle(const cv::Mat& mask, const cv::Rect& region, const cv::Size& size) {
+    RleMask rle;
+    rle.size = size;
+    if (size.area() == 0) return rle;
+
+    uint32_t run = 0;
+    bool value = false;
+    auto zeros = [&](size_t n) {
+        if (n == 0) return;
+        if (value) {
+            rle.counts.push_back(run);
+            run = 0;
+            value = false;
+        }
+        run += (uint32_t)n;
+    };
+
+    const cv::Rect r = region & cv::Rect(cv::Point(), size);
+    if (r.empty() || mask.empty()) {
+        zeros(size.area());
+        rle.counts.push_back(run);
+        return rle;
+    }
+    // COCO runs go down the columns, transposing first keeps the scan sequential
+    cv::Mat columns;
+    cv::transpose(mask(r - region.tl()), columns);
+
+    zeros((size_t)r.x * size.height);
+    for (int i = 0; i < columns.rows; i++) {
+        zeros(r.y);
+        const uchar* p = columns.ptr(i);
+        for (int j = 0; j < columns.cols; j++) {
+            if ((p[j] != 0) != value) {
+                rle.counts.push_back(run);
+                run = 0;
+                value = !value;
+            }
+            run++;
+        }
+        zeros(size.height - r.br().y);
+    }
+    zeros((size_t)(size.width - r.br().x) * size.height);
+    rle.counts.push_back(run);
+    return rle;
+}
+
+cv::Mat decodeRle(const RleMask& rle) {
+    cv::Mat columns(rle.size.width, rle.size.height, CV_8UC1);
+    uchar* p = columns.ptr();
+    const size_t total = columns.total();
+    size_t offset = 0;
+    uchar value = 0;
+    for (auto count : rle.counts) {
+        const size_t n = std::min<size_t>(count, total - offset);
+        memset(p + offset, value, n);
+        offset += n;
+        value = value ? 0 : 255;
+    }
+    memset(p + offset, 0, total - offset);
+
+    cv::Mat mask;
+    cv::transpose(columns, mask);
+    return mask;
+}
+
+cv::Rect maskBoundingBox(const cv::Mat& mask) {
+    if (mask.empty()) return cv::Rect();
+    return cv::boundingRect(mask);
+}
+
+void blendMask(const cv::Mat& image, const cv::Mat& mask, cv::Mat& out, const cv::Scalar& color,
+               double alpha, double backgroundScale) {
+    if (backgroundScale == 1.0) {
+        image.copyTo(out);
+    } else {
+        image.convertTo(out, -1, backgroundScale);
+    }
+    if (mask.size() != image.size()) return;
+    const cv::Rect box = maskBoundingBox(mask);
+    if (box.empty()) return;
+    // image * (1 - alpha) + color * alpha
+    cv::Mat blended;
+    cv::addWeighted(image(box), 1.0 - alpha, cv::Mat(box.size(), image.type(), color), alpha, 0,
+                    blended);
+    blended.copyTo(out(box), mask(box));
+}
+
+std::vector<std::vector<cv::Point>> maskPolygons(const cv::Mat& mask, double epsilon,
+                                                 double minArea) {
+    std::vector<std::vector<cv::Point>> contours, polygons;
+    if (mask.empty()) return polygons;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL,
+                     epsilon > 0 ? cv::CHAIN_APPROX_SIMPLE : cv::CHAIN_APPROX_NONE);
+    for (auto& contour : contours) {
+        if (minArea > 0 && cv::contourArea(contour) < minArea) continue;
+        if (epsilon > 0) {
+            std::vector<cv::Point> polygon;
+            cv::approxPolyDP(contour, polygon, epsilon, true);
+            polygons.push_back(std::move(polygon));
+        } else {
+            polygons.push_back(std::move(contour));
+        }
+    }
+    return polygons;
+}
@@ -0,0 +1,34 @@
+#ifndef SAMCPP__MASK_UTILS_H_
+#define SAMCPP__MASK_UTILS_H_
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <vector>
+
+// COCO style uncompressed run-length encoding: column-major runs, starting with a run of zeros
+struct RleMask {
+    cv::Size size;
+    std::vector<uint32_t> counts;
+};
+
+// mask: CV_8UC1, any non-zero pixel is foreground
+RleMask encodeRle(const cv::Mat& mask);
+// RLE of a size frame whose foreground is inside region, mask covering region only (e.g.
+// Sam::MaskOutput::MaskCropped and its box); only the region is scanned
+RleMask encodeRle(const cv::Mat& mask, const cv::Rect& region, const cv::Size& size);
+cv::Mat decodeRle(const RleMask& rle);
+// Bounding box of the non-zero pixels, empty for an empty mask
+cv::Rect maskBoundingBox(const cv::Mat& mask);
+
+// Composites mask over image into out (CV_8UC3, reused when it fits): foreground pixels are
+// blended towards color by alpha, background pixels are scaled by backgroundScale. Saturating
+// vectorized arithmetic; only the mask's bounding box is blended.
+void blendMask(const cv::Mat& image, const cv::Mat& mask, cv::Mat& out, const cv::Scalar& color,
+               double alpha, double backgroundScale = 1.0);
+
+// Outer contours of the mask, simplified to polygons with at most epsilon pixels of deviation
+// (0 - every contour pixel). Polygons enclosing less than minArea pixels are dropped.
+std::vector<std::vector<cv::Point>> maskPolygons(const cv::Mat& mask, double epsilon = 1.0,
+                                                 double minArea = 0);
+
+#endif  // SAMCPP__MASK_UTILS_H_
@@ -0,0 +1,74 @@
+#ifndef SAMCPP__OBJECT_POOL_H_
+#define SAMCPP__OBJECT_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Thread-safe free list of reusable objects (decoder states, encoder input buffers). Objects are
+// created on demand; with a limit, acquire() blocks while that many are leased out.
+template <typename T>
+class ObjectPool {
+    std::vector<std::unique_ptr<T>> m_free;
+    std::function<std::unique_ptr<T>()> m_create;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    size_t m_limit, m_created{0};
+
+    void release(std::unique_ptr<T> object) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(std::move(object));
+        }
+        m_released.notify_one();
+    }
+
+public:
+    // Returns its object to the pool when destroyed
+    class Lease {
+        ObjectPool* m_pool;
+        std::unique_ptr<T> m_object;
+
+    public:
+        Lease(ObjectPool* pool, std::unique_ptr<T> object)
+            : m_pool(pool), m_object(std::move(object)) {}
+        Lease(Lease&&) = default;
+        ~Lease() {
+            if (m_object) m_pool->release(std::move(m_object));
+        }
+        T& operator*() const { return *m_object; }
+        T* operator->() const { return m_object.get(); }
+    };
+
+    // limit: maximum number of objects, 0 - unbounded
+    explicit ObjectPool(std::function<std::unique_ptr<T>()> create, size_t limit = 0)
+        : m_create(std::move(create)), m_limit(limit) {}
+
+    Lease acquire() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_released.wait(lock,
+                        [this] { return !m_free.empty() || !m_limit || m_created < m_limit; });
+        if (!m_free.empty()) {
+            auto object = std::move(m_free.back());
+            m_free.pop_back();
+            return Lease(this, std::move(object));
+        }
+        m_created++;
+        lock.unlock();
+        // created outside the lock, it may allocate large buffers
+        try {
+            return Lease(this, m_create());
+        } catch (...) {
+            // give the slot back, or a limited pool would block forever once all failed
+            lock.lock();
+            m_created--;
+            lock.unlock();
+            m_released.notify_one();
+            throw;
+        }
+    }
+};
+
+#endif  // SAMCPP__OBJECT_POOL_H_
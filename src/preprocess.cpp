@@ -0,0 +1,144 @@
+#include "preprocess.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SAM_PREPROCESS_NEON
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SAM_PREPROCESS_AVX2
+#endif
+
+static void packBgrRowScalar(const uchar* src, int width, float* r, float* g, float* b,
+                             float scale) {
+    for (int j = 0; j < width; j++) {
+        b[j] = src[3 * j] * scale;
+        g[j] = src[3 * j + 1] * scale;
+        r[j] = src[3 * j + 2] * scale;
+    }
+}
+
+#ifdef SAM_PREPROCESS_NEON
+static void packBgrRow(const uchar* src, int width, float* r, float* g, float* b, float scale) {
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        const uint8x16x3_t bgr = vld3q_u8(src + 3 * j);
+        float* planes[3]{b + j, g + j, r + j};
+        for (int c = 0; c < 3; c++) {
+            const uint16x8_t lo = vmovl_u8(vget_low_u8(bgr.val[c]));
+            const uint16x8_t hi = vmovl_u8(vget_high_u8(bgr.val[c]));
+            vst1q_f32(planes[c], vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+            vst1q_f32(planes[c] + 4,
+                      vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+            vst1q_f32(planes[c] + 8,
+                      vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+            vst1q_f32(planes[c] + 12,
+                      vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+        }
+    }
+    packBgrRowScalar(src + 3 * j, width - j, r + j, g + j, b + j, scale);
+}
+#endif
+
+#ifdef SAM_PREPROCESS_AVX2
+__attribute__((target("avx2"))) static inline void storeScaled(float* dst, __m128i bytes,
+                                                                __m256 scale) {
+    const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+    _mm256_storeu_ps(dst, _mm256_mul_ps(lo, scale));
+    _mm256_storeu_ps(dst + 8, _mm256_mul_ps(hi, scale));
+}
+
+__attribute__((target("avx2"))) static void packBgrRowAvx2(const uchar* src, int width, float* r,
+                                                            float* g, float* b, float scale) {
+    // byte shuffles gathering one channel of 16 pixels out of three 16 byte loads
+    const __m128i bMask[3]{
+        _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)};
+    const __m128i gMask[3]{
+        _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)};
+    const __m128i rMask[3]{
+        _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)};
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        const uchar* p = src + 3 * j;
+        const __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+        const __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        const __m128i v2 = _mm_loadu_si128((const __m128i*)(p + 32));
+        const __m128i bv = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(v0, bMask[0]), _mm_shuffle_epi8(v1, bMask[1])),
+            _mm_shuffle_epi8(v2, bMask[2]));
+        const __m128i gv = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(v0, gMask[0]), _mm_shuffle_epi8(v1, gMask[1])),
+            _mm_shuffle_epi8(v2, gMask[2]));
+        const __m128i rv = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(v0, rMask[0]), _mm_shuffle_epi8(v1, rMask[1])),
+            _mm_shuffle_epi8(v2, rMask[2]));
+        storeScaled(b + j, bv, scaleVec);
+        storeScaled(g + j, gv, scaleVec);
+        storeScaled(r + j, rv, scaleVec);
+    }
+    packBgrRowScalar(src + 3 * j, width - j, r + j, g + j, b + j, scale);
+}
+
+static void packBgrRow(const uchar* src, int width, float* r, float* g, float* b, float scale) {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) {
+        packBgrRowAvx2(src, width, r, g, b, scale);
+    } else {
+        packBgrRowScalar(src, width, r, g, b, scale);
+    }
+}
+#endif
+
+#if !defined(SAM_PREPROCESS_NEON) && !defined(SAM_PREPROCESS_AVX2)
+static void packBgrRow(const uchar* src, int width, float* r, float* g, float* b, float scale) {
+    packBgrRowScalar(src, width, r, g, b, scale);
+}
+#endif
+
+void packBgrToPlanarRgb(const cv::Mat& image, float* dst, size_t rowStride, size_t planeStride,
+                        float scale) {
+    CV_Assert(image.type() == CV_8UC3);
+    const int width = image.cols;
+    float *r = dst, *g = dst + planeStride, *b = dst + 2 * planeStride;
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            const size_t offset = (size_t)i * rowStride;
+            packBgrRow(image.ptr(i), width, r + offset, g + offset, b + offset, scale);
+        }
+    });
+}
+
+Sam::ImageTransform letterbox(const cv::Size& sourceSize, const cv::Size& inputSize, bool center) {
+    Sam::ImageTransform transform;
+    transform.sourceSize = sourceSize;
+    transform.inputSize = inputSize;
+    transform.scale = std::min((double)inputSize.width / sourceSize.width,
+                               (double)inputSize.height / sourceSize.height);
+    // at least one pixel: the short side of a long thin image may round to 0
+    transform.resizedSize = cv::Size(
+        std::max(std::min(cvRound(sourceSize.width * transform.scale), inputSize.width), 1),
+        std::max(std::min(cvRound(sourceSize.height * transform.scale), inputSize.height), 1));
+    if (center) {
+        transform.offset = cv::Point((inputSize.width - transform.resizedSize.width) / 2,
+                                     (inputSize.height - transform.resizedSize.height) / 2);
+    }
+    return transform;
+}
+
+cv::Rect lowResCrop(const cv::Size& maskSize, const Sam::ImageTransform& transform) {
+    const double rx = (double)maskSize.width / transform.inputSize.width,
+                 ry = (double)maskSize.height / transform.inputSize.height;
+    const cv::Rect inputRect = transform.inputRect();
+    return cv::Rect(cvRound(inputRect.x * rx), cvRound(inputRect.y * ry),
+                    std::max(cvRound(inputRect.width * rx), 1),
+                    std::max(cvRound(inputRect.height * ry), 1)) &
+           cv::Rect(cv::Point(), maskSize);
+}
@@ -0,0 +1,20 @@
+#ifndef SAMCPP__PREPROCESS_H_
+#define SAMCPP__PREPROCESS_H_
+
+#include <opencv2/core.hpp>
+#include "edgeSam.h"
+
+// Converts an interleaved BGR CV_8UC3 image (HWC) to planar RGB floats (CHW) multiplied by scale,
+// in one pass. dst points at the top-left pixel of the first of three planes spaced planeStride
+// floats apart, rows are rowStride floats apart.
+void packBgrToPlanarRgb(const cv::Mat& image, float* dst, size_t rowStride, size_t planeStride,
+                        float scale);
+
+// Aspect preserving fit of sourceSize into inputSize. The resized image is placed at the top left
+// like SAM does, or centered.
+Sam::ImageTransform letterbox(const cv::Size& sourceSize, const cv::Size& inputSize,
+                              bool center = false);
+// Area of a maskSize low resolution mask covering the image, the rest of it is letterbox padding
+cv::Rect lowResCrop(const cv::Size& maskSize, const Sam::ImageTransform& transform);
+
+#endif  // SAMCPP__PREPROCESS_H_
@@ -0,0 +1,359 @@
+// _edgesam: Python bindings of Sam, see edgesam_py/native.py
+//
+// Images and masks cross the boundary without copies: contiguous uint8 HxWx3 BGR arrays (as
+// cv2 returns them) are wrapped in cv::Mat headers, returned masks are arrays over the cv::Mat
+// buffers, kept alive by a capsule. encode / decode calls release the GIL while they run.
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "edgeSam.h"
+#include "embeddingCodec.h"
+#include "objectPool.h"
+
+namespace py = pybind11;
+
+using ImageArray = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>;
+
+// cv::Mat header over a HxWx3 uint8 array, valid while the array is
+static cv::Mat wrapImage(const ImageArray& image) {
+    if (image.ndim() != 3 || image.shape(2) != 3) {
+        throw std::invalid_argument("expected a HxWx3 uint8 BGR image");
+    }
+    return cv::Mat((int)image.shape(0), (int)image.shape(1), CV_8UC3, (void*)image.data());
+}
+
+// Array over the buffer of a CV_8UC1 / CV_32FC1 mat, which the array keeps alive
+static py::array wrapMat(const cv::Mat& mat) {
+    if (mat.empty()) return py::array_t<uint8_t>(std::vector<py::ssize_t>{0, 0});
+    auto* owner = new cv::Mat(mat.isContinuous() ? mat : mat.clone());
+    py::capsule free(owner, [](void* p) { delete static_cast<cv::Mat*>(p); });
+    const auto dtype = owner->depth() == CV_8U ? py::dtype::of<uint8_t>() : py::dtype::of<float>();
+    return py::array(dtype, {(py::ssize_t)owner->rows, (py::ssize_t)owner->cols},
+                     {(py::ssize_t)owner->step[0], (py::ssize_t)owner->elemSize()}, owner->data,
+                     free);
+}
+
+static const char* const kStorageNames[]{"float32", "float16", "int8"};
+
+static Sam::EmbeddingStorage toStorage(const std::string& name) {
+    for (int i = 0; i < 3; i++) {
+        if (name == kStorageNames[i]) return (Sam::EmbeddingStorage)i;
+    }
+    throw std::invalid_argument("embedding_storage must be float32, float16 or int8");
+}
+
+static void check(bool ok) {
+    if (!ok) throw std::runtime_error(Sam::statusMessage(Sam::lastError()));
+}
+
+// points: sequence of (x, y), e.g. a Nx2 array; None - no points
+static std::list<cv::Point> toPoints(const py::object& points) {
+    std::list<cv::Point> result;
+    if (points.is_none()) return result;
+    for (auto point : points) {
+        const auto xy = point.cast<std::array<double, 2>>();
+        result.push_back(cv::Point(cvRound(xy[0]), cvRound(xy[1])));
+    }
+    return result;
+}
+
+// box: (x1, y1, x2, y2); None - no box
+static cv::Rect toBox(const py::object& box) {
+    if (box.is_none()) return cv::Rect();
+    const auto b = box.cast<std::array<double, 4>>();
+    return cv::Rect(cv::Point(cvRound(b[0]), cvRound(b[1])),
+                    cv::Point(cvRound(b[2]), cvRound(b[3])));
+}
+
+static Sam::MaskOutput toMaskOutput(const std::string& name) {
+    static const std::map<std::string, Sam::MaskOutput> outputs{
+        {"binary", Sam::MaskOutput::Binary},
+        {"probability", Sam::MaskOutput::Probability},
+        {"low_res_logits", Sam::MaskOutput::LowResLogits},
+        {"box_cropped", Sam::MaskOutput::BoxCropped},
+        {"mask_cropped", Sam::MaskOutput::MaskCropped}};
+    auto it = outputs.find(name);
+    if (it == outputs.end()) throw std::invalid_argument("unknown mask output " + name);
+    return it->second;
+}
+
+struct PyEmbedding {
+    Sam::EmbeddingHandle handle;
+};
+
+static py::object wrapEmbedding(const Sam::EmbeddingHandle& embedding) {
+    if (!embedding) return py::none();
+    return py::cast(PyEmbedding{embedding});
+}
+
+class PySam {
+    std::unique_ptr<Sam> m_sam;
+    // decode contexts of concurrent callers, Python threads decode in parallel without the GIL
+    ObjectPool<Sam::DecodeContext> m_contexts;
+    std::mutex m_mutex;
+    Sam::EmbeddingHandle m_current;  // load_image
+
+public:
+    explicit PySam(const Sam::Parameter& param)
+        : m_sam(std::make_unique<Sam>(param)),
+          m_contexts([this]() { return std::make_unique<Sam::DecodeContext>(*m_sam); }) {}
+
+    Sam& sam() { return *m_sam; }
+
+    Sam::EmbeddingHandle current() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_current;
+    }
+
+    Sam::EmbeddingHandle encode(const ImageArray& image) {
+        const cv::Mat mat = wrapImage(image);
+        Sam::EmbeddingHandle embedding;
+        {
+            py::gil_scoped_release release;
+            embedding = m_sam->encode(mat);
+        }
+        check(embedding != nullptr);
+        return embedding;
+    }
+
+    void loadImage(const ImageArray& image) {
+        auto embedding = encode(image);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current = std::move(embedding);
+    }
+
+    py::list encodeBatch(const std::vector<ImageArray>& images) {
+        std::vector<cv::Mat> mats;
+        for (auto& image : images) {
+            mats.push_back(wrapImage(image));
+        }
+        std::vector<Sam::EmbeddingHandle> embeddings;
+        {
+            py::gil_scoped_release release;
+            embeddings = m_sam->encodeBatch(mats);
+        }
+        py::list result;
+        for (auto& embedding : embeddings) {
+            result.append(wrapEmbedding(embedding));
+        }
+        return result;
+    }
+
+    Sam::EmbeddingHandle resolve(const py::object& embedding) {
+        auto handle = embedding.is_none() ? current() : embedding.cast<PyEmbedding&>().handle;
+        if (!handle) throw std::runtime_error(Sam::statusMessage(Sam::Status::NoEmbedding));
+        return handle;
+    }
+
+    py::tuple getMask(const py::object& points, const py::object& negativePoints,
+                      const py::object& box, const py::object& embedding,
+                      const std::string& output, float threshold, bool bestCandidate) {
+        const auto handle = resolve(embedding);
+        Sam::Prompt prompt{toPoints(points), toPoints(negativePoints), toBox(box)};
+        Sam::MaskOptions options;
+        options.output = toMaskOutput(output);
+        options.threshold = threshold;
+        options.bestCandidate = bestCandidate;
+        cv::Mat mask;
+        double iou = 0;
+        cv::Rect maskBox;
+        bool ok = false;
+        {
+            py::gil_scoped_release release;
+            auto context = m_contexts.acquire();
+            ok = m_sam->getMask(*context, handle, prompt, options, mask, &iou, &maskBox);
+        }
+        check(ok);
+        return py::make_tuple(wrapMat(mask), iou,
+                              py::make_tuple(maskBox.x, maskBox.y, maskBox.width, maskBox.height));
+    }
+
+    // prompts: dicts with optional "points", "negative_points" and "box"
+    py::tuple getMasks(const py::list& prompts, const py::object& embedding, bool lowRes) {
+        const auto handle = resolve(embedding);
+        std::vector<Sam::Prompt> samPrompts;
+        for (auto item : prompts) {
+            const auto prompt = item.cast<py::dict>();
+            auto get = [&](const char* key) {
+                return prompt.contains(key) ? py::object(prompt[key]) : py::object(py::none());
+            };
+            samPrompts.push_back(
+                Sam::Prompt{toPoints(get("points")), toPoints(get("negative_points")),
+                            toBox(get("box"))});
+        }
+        std::vector<cv::Mat> masks;
+        std::vector<double> ious;
+        {
+            py::gil_scoped_release release;
+            masks = lowRes ? m_sam->getLowResMasks(handle, samPrompts, &ious)
+                           : m_sam->getMasks(handle, samPrompts, &ious);
+        }
+        check(masks.size() == samPrompts.size());
+        py::list result;
+        for (auto& mask : masks) {
+            result.append(wrapMat(mask));
+        }
+        return py::make_tuple(result, ious);
+    }
+};
+
+static py::dict metricsDict(const Sam::Metrics& metrics) {
+    static const char* stageNames[]{"preprocess", "encoder_run", "decoder_run", "postprocess"};
+    py::dict stages;
+    for (int i = 0; i < 4; i++) {
+        py::dict stage;
+        stage["count"] = metrics.stages[i].count;
+        stage["total_ms"] = metrics.stages[i].totalMilliseconds;
+        stage["max_ms"] = metrics.stages[i].maxMilliseconds;
+        stages[stageNames[i]] = stage;
+    }
+    py::dict result;
+    result["stages"] = stages;
+    result["cache_hits"] = metrics.cacheHits;
+    result["cache_misses"] = metrics.cacheMisses;
+    result["allocations"] = metrics.allocations;
+    return result;
+}
+
+PYBIND11_MODULE(_edgesam, m) {
+    m.doc() = "EdgeSAM C++ engine";
+
+    m.def("pool_stats", []() {
+        const auto stats = Sam::poolStats();
+        py::dict result;
+        result["in_use_bytes"] = stats.inUseBytes;
+        result["cached_bytes"] = stats.cachedBytes;
+        result["resident_bytes"] = stats.residentBytes;
+        result["peak_resident_bytes"] = stats.peakResidentBytes;
+        result["hits"] = stats.hits;
+        result["misses"] = stats.misses;
+        return result;
+    });
+    m.def("set_pool_limit", &Sam::setPoolLimit, py::arg("bytes"));
+
+    py::class_<PyEmbedding>(m, "Embedding")
+        .def_property_readonly("shape",
+                               [](const PyEmbedding& e) { return e.handle->shape; })
+        .def_property_readonly("key", [](const PyEmbedding& e) { return e.handle->key; })
+        .def_property_readonly("source_size",
+                               [](const PyEmbedding& e) {
+                                   const auto& size = e.handle->transform.sourceSize;
+                                   return py::make_tuple(size.width, size.height);
+                               })
+        .def_property_readonly(
+            "storage", [](const PyEmbedding& e) { return kStorageNames[(int)e.handle->storage]; })
+        // read-only view of the embedding data, without a copy; compressed embeddings are
+        // expanded into a float32 copy
+        .def_property_readonly("values", [](const PyEmbedding& e) {
+            if (e.handle->onDevice()) {
+                throw std::runtime_error("device embedding, it has no host data");
+            }
+            std::vector<py::ssize_t> shape(e.handle->shape.begin(), e.handle->shape.end());
+            if (e.handle->isCompressed()) {
+                py::array_t<float> copy(shape);
+                cv::Mat values(1, (int)e.handle->size(), CV_32FC1, copy.mutable_data());
+                expandEmbedding(*e.handle, values, CV_32F);
+                copy.attr("setflags")(py::arg("write") = false);
+                return py::array(copy);
+            }
+            auto* owner = new Sam::EmbeddingHandle(e.handle);
+            py::capsule free(owner, [](void* p) { delete static_cast<Sam::EmbeddingHandle*>(p); });
+            py::array values(py::dtype::of<float>(), shape, e.handle->data(), free);
+            values.attr("setflags")(py::arg("write") = false);
+            return values;
+        });
+
+    py::class_<PySam>(m, "Sam")
+        .def(py::init([](const std::string& encoder, const std::string& decoder, int threads,
+                         int encoderDevice, int decoderDevice, int gpuDeviceId,
+                         size_t embeddingCacheBytes, int maxDecoderBatch, bool centerLetterbox,
+                         bool collectMetrics, const std::string& optimizedModelDir,
+                         bool lazyDecoder, bool warmup, bool deviceIo,
+                         const std::string& embeddingStorage) {
+                 Sam::Parameter param(encoder, decoder, threads);
+                 param.providers[0].deviceType = encoderDevice;
+                 param.providers[1].deviceType = decoderDevice;
+                 param.providers[0].gpuDeviceId = param.providers[1].gpuDeviceId = gpuDeviceId;
+                 param.embeddingCacheBytes = embeddingCacheBytes;
+                 param.maxDecoderBatch = maxDecoderBatch;
+                 param.centerLetterbox = centerLetterbox;
+                 param.collectMetrics = collectMetrics;
+                 param.optimizedModelDir = optimizedModelDir;
+                 param.lazyDecoder = lazyDecoder;
+                 param.warmup = warmup;
+                 param.deviceIo = deviceIo;
+                 param.embeddingStorage = toStorage(embeddingStorage);
+                 py::gil_scoped_release release;
+                 return std::make_unique<PySam>(param);
+             }),
+             py::arg("encoder") = "", py::arg("decoder") = "", py::arg("threads") = 1,
+             py::arg("encoder_device") = 0, py::arg("decoder_device") = 0,
+             py::arg("gpu_device_id") = 0, py::arg("embedding_cache_bytes") = 0,
+             py::arg("max_decoder_batch") = 64, py::arg("center_letterbox") = false,
+             py::arg("collect_metrics") = false, py::arg("optimized_model_dir") = "",
+             py::arg("lazy_decoder") = false, py::arg("warmup") = false,
+             py::arg("device_io") = false, py::arg("embedding_storage") = "float32")
+        .def_property_readonly("is_loaded", [](PySam& self) { return self.sam().isLoaded(); })
+        .def_property_readonly(
+            "load_status",
+            [](PySam& self) { return std::string(Sam::statusMessage(self.sam().loadStatus())); })
+        .def_property_readonly("input_size",
+                               [](PySam& self) {
+                                   const auto size = self.sam().getInputSize();
+                                   return py::make_tuple(size.width, size.height);
+                               })
+        .def_property_readonly("model_family",
+                               [](PySam& self) {
+                                   return self.sam().modelFamily() == Sam::ModelFamily::Sam
+                                              ? "sam"
+                                              : "edgesam";
+                               })
+        .def(
+            "encode",
+            [](PySam& self, const ImageArray& image) { return PyEmbedding{self.encode(image)}; },
+            py::arg("image"))
+        .def("load_image", &PySam::loadImage, py::arg("image"))
+        .def("encode_batch", &PySam::encodeBatch, py::arg("images"))
+        .def("get_mask", &PySam::getMask, py::arg("points") = py::none(),
+             py::arg("negative_points") = py::none(), py::arg("box") = py::none(),
+             py::arg("embedding") = py::none(), py::arg("output") = "binary",
+             py::arg("threshold") = 0.f, py::arg("best_candidate") = false)
+        .def(
+            "get_masks",
+            [](PySam& self, const py::list& prompts, const py::object& embedding) {
+                return self.getMasks(prompts, embedding, false);
+            },
+            py::arg("prompts"), py::arg("embedding") = py::none())
+        .def(
+            "get_low_res_masks",
+            [](PySam& self, const py::list& prompts, const py::object& embedding) {
+                return self.getMasks(prompts, embedding, true);
+            },
+            py::arg("prompts"), py::arg("embedding") = py::none())
+        .def("clear_embedding_cache", [](PySam& self) { self.sam().clearEmbeddingCache(); })
+        .def(
+            "save_embedding",
+            [](PySam& self, const PyEmbedding& embedding, const std::string& path, bool fp16) {
+                check(self.sam().saveEmbedding(embedding.handle, path, fp16));
+            },
+            py::arg("embedding"), py::arg("path"), py::arg("fp16") = false)
+        .def(
+            "load_embedding",
+            [](PySam& self, const std::string& path) {
+                auto embedding = self.sam().loadEmbedding(path);
+                check(embedding != nullptr);
+                return PyEmbedding{embedding};
+            },
+            py::arg("path"))
+        .def("metrics", [](PySam& self) { return metricsDict(self.sam().metrics()); })
+        .def("metrics_prometheus", [](PySam& self) { return self.sam().metricsPrometheus(); })
+        .def("reset_metrics", [](PySam& self) { self.sam().resetMetrics(); });
+}
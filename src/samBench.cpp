@@ -0,0 +1,173 @@
+// sam_bench: per-stage latency and throughput of Sam, reported as JSON
+//
+//   sam_bench [--variant edge_sam|edge_sam_3x] [--models-dir ../models] [--encoder path]
+//             [--decoder path] [--image path] [--provider cpu|cuda|tensorrt|xnnpack|coreml]
+//             [--threads n] [--prompts n] [--iterations n] [--warmup n] [--output file.json]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cliOptions.h"
+#include "edgeSam.h"
+
+struct BenchOptions {
+    ModelOptions model;
+    std::string image, output;
+    int prompts{8}, iterations{20}, warmup{3};
+};
+
+static bool parseArgs(int argc, char** argv, BenchOptions& options) {
+    return parseArgs(argc, argv, options.model,
+                     [&](const std::string& arg, const std::string& value) {
+                         if (arg == "--image") {
+                             options.image = value;
+                         } else if (arg == "--prompts") {
+                             options.prompts = std::max(std::atoi(value.c_str()), 1);
+                         } else if (arg == "--iterations") {
+                             options.iterations = std::max(std::atoi(value.c_str()), 1);
+                         } else if (arg == "--warmup") {
+                             options.warmup = std::max(std::atoi(value.c_str()), 0);
+                         } else if (arg == "--output") {
+                             options.output = value;
+                         } else {
+                             return false;
+                         }
+                         return true;
+                     });
+}
+
+static std::string jsonString(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Nearest rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    const size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static std::string statsJson(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    const double total = std::accumulate(samples.begin(), samples.end(), 0.0);
+    const double mean = samples.empty() ? 0 : total / samples.size();
+    std::ostringstream json;
+    json << "{\"count\": " << samples.size() << ", \"mean_ms\": " << mean
+         << ", \"p50_ms\": " << percentile(samples, 50) << ", \"p95_ms\": "
+         << percentile(samples, 95) << ", \"p99_ms\": " << percentile(samples, 99)
+         << ", \"throughput_per_s\": " << (mean > 0 ? 1000.0 / mean : 0) << "}";
+    return json.str();
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArgs(argc, argv, options)) return 1;
+
+    cv::Mat image;
+    if (!options.image.empty()) {
+        image = cv::imread(options.image);
+        if (image.empty()) {
+            std::cerr << "Image loading failed" << std::endl;
+            return 1;
+        }
+    } else {
+        image = cv::Mat(720, 1280, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    }
+
+    // stage samples, only recorded after the warmup iterations
+    static const char* stageNames[]{"preprocess", "encoder_run", "decoder_run", "postprocess"};
+    std::vector<double> stageSamples[4];
+    std::mutex samplesMutex;
+    bool recording = false;
+
+    Sam::Parameter param(options.model.encoder, options.model.decoder, options.model.threads);
+    param.providers[0].deviceType = param.providers[1].deviceType = options.model.deviceType;
+    param.stageObserver = [&](Sam::Stage stage, double milliseconds) {
+        std::lock_guard<std::mutex> lock(samplesMutex);
+        if (recording) stageSamples[(int)stage].push_back(milliseconds);
+    };
+    Sam sam(param);
+    if (!sam.isLoaded()) {
+        std::cerr << "Sam initialization failed" << std::endl;
+        return 1;
+    }
+
+    // prompt points spread over the image
+    std::vector<Sam::Prompt> prompts(options.prompts);
+    cv::RNG rng(12345);
+    for (auto& prompt : prompts) {
+        prompt.points.push_back(cv::Point(rng.uniform(0, image.cols), rng.uniform(0, image.rows)));
+    }
+
+    Sam::DecodeContext context(sam);
+    std::vector<double> encodeSamples, decodeSamples;
+    cv::Mat mask;
+    for (int iteration = 0; iteration < options.warmup + options.iterations; iteration++) {
+        {
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            recording = iteration >= options.warmup;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto embedding = sam.encode(image);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (!embedding) {
+            std::cerr << "Encoding failed: " << Sam::statusMessage(Sam::lastError()) << std::endl;
+            return 1;
+        }
+        if (recording) encodeSamples.push_back(elapsed.count());
+
+        for (auto& prompt : prompts) {
+            start = std::chrono::steady_clock::now();
+            const bool decoded = sam.getMask(context, embedding, prompt, Sam::MaskOptions(), mask);
+            elapsed = std::chrono::steady_clock::now() - start;
+            if (!decoded) {
+                std::cerr << "Decoding failed: " << Sam::statusMessage(Sam::lastError())
+                          << std::endl;
+                return 1;
+            }
+            if (recording) decodeSamples.push_back(elapsed.count());
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n  \"variant\": " << jsonString(options.model.variant)
+         << ",\n  \"encoder\": " << jsonString(options.model.encoder)
+         << ",\n  \"decoder\": " << jsonString(options.model.decoder)
+         << ",\n  \"provider\": " << jsonString(options.model.provider) << ",\n  \"threads\": "
+         << options.model.threads << ",\n  \"prompts\": " << options.prompts
+         << ",\n  \"iterations\": " << options.iterations << ",\n  \"image\": [" << image.cols
+         << ", " << image.rows << "],\n  \"stages\": {\n";
+    for (int i = 0; i < 4; i++) {
+        json << "    \"" << stageNames[i] << "\": " << statsJson(stageSamples[i])
+             << (i < 3 ? ",\n" : "\n");
+    }
+    json << "  },\n  \"encode\": " << statsJson(encodeSamples)
+         << ",\n  \"decode\": " << statsJson(decodeSamples) << "\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream f(options.output);
+        f << json.str();
+        if (!f.good()) {
+            std::cerr << "Cannot write " << options.output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
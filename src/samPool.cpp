@@ -0,0 +1,166 @@
+#include "samPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Worker threads, one per Sam instance, each with its own job deque. A worker runs its own jobs
+// oldest first and, when it has none, steals the newest job of another worker.
+class SamPool::WorkerGroup {
+public:
+    struct Worker {
+        std::unique_ptr<Sam> sam;
+        std::unique_ptr<Sam::DecodeContext> context;  // decoder workers only
+        std::mutex mutex;
+        std::deque<std::function<void(Worker&)>> jobs;
+        std::thread thread;
+    };
+    using Job = std::function<void(Worker&)>;
+
+    WorkerGroup(std::vector<std::unique_ptr<Sam>> instances, bool decoder) {
+        for (auto& sam : instances) {
+            auto worker = std::make_unique<Worker>();
+            if (decoder) worker->context = std::make_unique<Sam::DecodeContext>(*sam);
+            worker->sam = std::move(sam);
+            m_workers.push_back(std::move(worker));
+        }
+        for (size_t i = 0; i < m_workers.size(); i++) {
+            m_workers[i]->thread = std::thread(&WorkerGroup::run, this, i);
+        }
+    }
+
+    ~WorkerGroup() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers) {
+            worker->thread.join();
+        }
+    }
+
+    size_t size() const { return m_workers.size(); }
+
+    void submit(Job job) {
+        auto& worker = *m_workers[m_next++ % m_workers.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_pending++;
+        }
+        m_wake.notify_one();
+    }
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next{0};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    size_t m_pending{0};  // jobs queued in all deques
+    bool m_stop{false};
+
+    bool take(size_t self, Job& job) {
+        const size_t n = m_workers.size();
+        for (size_t i = 0; i < n; i++) {
+            auto& worker = *m_workers[(self + i) % n];
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                if (worker.jobs.empty()) continue;
+                if (i == 0) {
+                    job = std::move(worker.jobs.front());
+                    worker.jobs.pop_front();
+                } else {
+                    job = std::move(worker.jobs.back());
+                    worker.jobs.pop_back();
+                }
+            }
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_pending--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        Job job;
+        for (;;) {
+            if (take(self, job)) {
+                job(*m_workers[self]);
+                job = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_wake.wait(lock, [this] { return m_stop || m_pending > 0; });
+            if (m_stop && m_pending == 0) return;
+        }
+    }
+};
+
+// Loads one instance per parameter with only the given model slot, dropping the failed ones
+static std::vector<std::unique_ptr<Sam>> createInstances(
+    const std::vector<Sam::Parameter>& params, int slot) {
+    std::vector<std::unique_ptr<Sam>> instances;
+    for (auto param : params) {
+        param.models[1 - slot].clear();
+        auto sam = std::make_unique<Sam>(param);
+        if (!sam->isLoaded()) {
+            std::cerr << "Pool instance " << param.models[slot] << " not loaded" << std::endl;
+            continue;
+        }
+        instances.push_back(std::move(sam));
+    }
+    return instances;
+}
+
+SamPool::SamPool(const Parameter& param)
+    : m_encoders(new WorkerGroup(createInstances(param.encoders, 0), false)),
+      m_decoders(new WorkerGroup(createInstances(param.decoders, 1), true)) {}
+
+SamPool::~SamPool() = default;
+
+size_t SamPool::encoderCount() const { return m_encoders->size(); }
+size_t SamPool::decoderCount() const { return m_decoders->size(); }
+
+std::future<Sam::EmbeddingHandle> SamPool::encode(const cv::Mat& image) {
+    auto task = std::make_shared<std::packaged_task<Sam::EmbeddingHandle(WorkerGroup::Worker&)>>(
+        [image = image.clone()](WorkerGroup::Worker& worker) { return worker.sam->encode(image); });
+    auto result = task->get_future();
+    if (m_encoders->size() == 0) {
+        std::cerr << "No encoder in the pool" << std::endl;
+        std::promise<Sam::EmbeddingHandle> failed;
+        failed.set_value(nullptr);
+        return failed.get_future();
+    }
+    m_encoders->submit([task](WorkerGroup::Worker& worker) { (*task)(worker); });
+    return result;
+}
+
+std::future<SamPool::MaskResult> SamPool::getMask(const Sam::EmbeddingHandle& embedding,
+                                                  const Sam::Prompt& prompt,
+                                                  const Sam::MaskOptions& options) {
+    auto task = std::make_shared<std::packaged_task<MaskResult(WorkerGroup::Worker&)>>(
+        [embedding, prompt, options](WorkerGroup::Worker& worker) {
+            MaskResult result;
+            // jobs of unrelated callers share the worker's context, none refines another's mask
+            worker.context->reset();
+            result.ok = worker.sam->getMask(*worker.context, embedding, prompt, options,
+                                            result.mask, &result.iou, &result.box);
+            return result;
+        });
+    auto result = task->get_future();
+    if (m_decoders->size() == 0) {
+        std::cerr << "No decoder in the pool" << std::endl;
+        std::promise<MaskResult> failed;
+        failed.set_value(MaskResult());
+        return failed.get_future();
+    }
+    m_decoders->submit([task](WorkerGroup::Worker& worker) { (*task)(worker); });
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef SAMCPP__SAM_POOL_H_
+#define SAMCPP__SAM_POOL_H_
+
+#include <future>
+#include <memory>
+#include <vector>
+#include "edgeSam.h"
+
+// Serves requests with several encoder and decoder instances sharing one onnxruntime
+// environment, e.g. one encoder per GPU. Encoder and decoder jobs are queued to separate worker
+// groups so cheap decodes never wait behind encodes; within a group idle workers steal the
+// queued jobs of busy ones.
+class SamPool {
+public:
+    struct Parameter {
+        // one encoder-only instance per entry, models[1] is ignored
+        std::vector<Sam::Parameter> encoders;
+        // one decoder-only instance per entry, models[0] is ignored
+        std::vector<Sam::Parameter> decoders;
+    };
+
+    struct MaskResult {
+        bool ok{false};
+        cv::Mat mask;
+        double iou{0};
+        cv::Rect box;  // bounding box of the mask in source coordinates
+    };
+
+    explicit SamPool(const Parameter& param);
+    // finishes the queued jobs
+    ~SamPool();
+    SamPool(const SamPool&) = delete;
+    SamPool& operator=(const SamPool&) = delete;
+
+    size_t encoderCount() const;
+    size_t decoderCount() const;
+
+    // The image is copied. The future yields nullptr on failure.
+    std::future<Sam::EmbeddingHandle> encode(const cv::Mat& image);
+    // Embeddings from any encoder of the pool can be decoded by any decoder. Every job starts
+    // from a reset context, options.refine has no previous mask to refine.
+    std::future<MaskResult> getMask(const Sam::EmbeddingHandle& embedding,
+                                    const Sam::Prompt& prompt,
+                                    const Sam::MaskOptions& options = Sam::MaskOptions());
+
+private:
+    class WorkerGroup;
+    std::unique_ptr<WorkerGroup> m_encoders, m_decoders;
+};
+
+#endif  // SAMCPP__SAM_POOL_H_
@@ -0,0 +1,99 @@
+#include "samStream.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+struct SamStream::Object {
+    Sam::DecodeContext context;
+    Sam::Prompt prompt;  // the initial prompt, then the grown box of the last tracked mask
+    // embedding and roi of the last decode, the mask is reused when neither changed
+    Sam::EmbeddingHandle decodedEmbedding;
+    cv::Rect decodedRoi;
+    bool decoded{false};
+    ObjectResult last;
+
+    Object(const Sam& sam, const Sam::Prompt& initial) : context(sam), prompt(initial) {}
+};
+
+SamStream::SamStream(Sam& sam) : m_sam(sam) {}
+SamStream::SamStream(Sam& sam, const Parameter& param) : m_sam(sam), m_param(param) {}
+SamStream::~SamStream() = default;
+
+size_t SamStream::addObject(const Sam::Prompt& prompt) {
+    m_objects.push_back(std::make_unique<Object>(m_sam, prompt));
+    return m_objects.size() - 1;
+}
+
+void SamStream::removeObjects() { m_objects.clear(); }
+
+void SamStream::resetEmbedding() {
+    m_embedding.reset();
+    m_reusedFrames = 0;
+}
+
+// box grown by margin of its size on every side, clipped to the frame
+static cv::Rect growBox(const cv::Rect& box, double margin, const cv::Size& frameSize) {
+    const int dx = cvRound(box.width * margin), dy = cvRound(box.height * margin);
+    return cv::Rect(box.x - dx, box.y - dy, box.width + 2 * dx, box.height + 2 * dy) &
+           cv::Rect(cv::Point(), frameSize);
+}
+
+bool SamStream::reuseEmbedding(const cv::Mat& frame, double& difference) {
+    difference = 0;
+    // invalid frames are reported by the encode
+    if (frame.empty() || frame.type() != CV_8UC3) return false;
+
+    const int width = std::min(std::max(m_param.thumbnailWidth, 1), frame.cols);
+    const cv::Size size(width, std::max(cvRound((double)frame.rows * width / frame.cols), 1));
+    cv::resize(frame, m_resized, size, 0, 0, cv::INTER_AREA);
+    cv::cvtColor(m_resized, m_thumbnail, cv::COLOR_BGR2GRAY);
+
+    if (!m_embedding || m_embedding->transform.sourceSize != frame.size() ||
+        m_reference.size() != m_thumbnail.size()) {
+        return false;
+    }
+    difference = cv::norm(m_thumbnail, m_reference, cv::NORM_L1) / m_thumbnail.total();
+    if (m_param.maxReusedFrames > 0 && m_reusedFrames >= m_param.maxReusedFrames) return false;
+    return difference < m_param.reuseThreshold;
+}
+
+SamStream::FrameResult SamStream::process(const cv::Mat& frame) {
+    FrameResult result;
+    if (reuseEmbedding(frame, result.difference)) {
+        m_reusedFrames++;
+    } else {
+        auto embedding = m_sam.encode(frame);
+        if (!embedding) return result;
+        m_embedding = std::move(embedding);
+        m_thumbnail.copyTo(m_reference);
+        m_reusedFrames = 0;
+        result.encoded = true;
+    }
+    result.ok = true;
+
+    result.objects.resize(m_objects.size());
+    for (size_t i = 0; i < m_objects.size(); i++) {
+        auto& object = *m_objects[i];
+        // same embedding and prompt box: the decoder would return the same mask
+        if (object.decoded && object.decodedEmbedding == m_embedding &&
+            object.decodedRoi == object.prompt.roi) {
+            result.objects[i] = object.last;
+            continue;
+        }
+
+        auto& out = object.last;
+        out.ok = m_sam.getMask(object.context, m_embedding, object.prompt, m_param.maskOptions,
+                               out.mask, &out.iou, &out.box) &&
+                 !out.box.empty();
+        object.decoded = true;
+        object.decodedEmbedding = m_embedding;
+        object.decodedRoi = object.prompt.roi;
+        // a lost object keeps its last prompt, so it is searched for where it was seen
+        if (out.ok) {
+            object.prompt.points.clear();
+            object.prompt.negativePoints.clear();
+            object.prompt.roi = growBox(out.box, m_param.boxMargin, frame.size());
+        }
+        result.objects[i] = out;
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#ifndef SAMCPP__SAM_STREAM_H_
+#define SAMCPP__SAM_STREAM_H_
+
+#include <memory>
+#include <vector>
+#include "edgeSam.h"
+
+// Video / camera streams: segments tracked objects frame after frame. The encoder only runs when
+// the scene changed, judged by the mean absolute difference of a small gray thumbnail against
+// the last encoded frame; otherwise that frame's embedding is reused. Each object is prompted
+// with its mask box from the previous frame, grown by a margin, through the roi path of getMask.
+// One stream per video source, its methods are not meant to be called concurrently.
+class SamStream {
+public:
+    struct Parameter {
+        // mean absolute gray level difference (0 - 255) below which the last embedding is reused
+        double reuseThreshold{3.0};
+        int maxReusedFrames{30};  // frames in a row reusing one embedding, 0 - no limit
+        int thumbnailWidth{64};   // width the frames are compared at
+        // growth of the previous box on every side, as a fraction of its size, so the object
+        // may move between frames
+        double boxMargin{0.15};
+        Sam::MaskOptions maskOptions;  // output mode of the tracked masks
+    };
+
+    struct ObjectResult {
+        bool ok{false};  // false when the object was lost: empty mask or failed decode
+        cv::Mat mask;
+        double iou{0};
+        cv::Rect box;  // bounding box of the mask in frame coordinates
+    };
+    struct FrameResult {
+        bool ok{false};       // false when the frame could not be encoded
+        bool encoded{false};  // the encoder ran for this frame, false - embedding reused
+        double difference{0};  // to the last encoded frame, 0 when encoded unconditionally
+        std::vector<ObjectResult> objects;  // in addObject order
+    };
+
+    SamStream(Sam& sam);
+    SamStream(Sam& sam, const Parameter& param);
+    ~SamStream();
+    SamStream(const SamStream&) = delete;
+    SamStream& operator=(const SamStream&) = delete;
+
+    // Tracks an object from the next frame on, initially segmented with prompt (points and / or
+    // roi in frame coordinates). Returns its index in FrameResult::objects.
+    size_t addObject(const Sam::Prompt& prompt);
+    void removeObjects();
+    // forgets the last embedding, the next frame is encoded
+    void resetEmbedding();
+
+    // The mask buffers of the result are reused by the next call, clone them to keep them
+    FrameResult process(const cv::Mat& frame);
+
+    Sam::EmbeddingHandle embedding() const { return m_embedding; }
+
+private:
+    struct Object;
+
+    Sam& m_sam;
+    Parameter m_param;
+    std::vector<std::unique_ptr<Object>> m_objects;
+    Sam::EmbeddingHandle m_embedding;
+    // thumbnails of the last encoded and the current frame
+    cv::Mat m_reference, m_thumbnail, m_resized;
+    int m_reusedFrames{0};
+
+    bool reuseEmbedding(const cv::Mat& frame, double& difference);
+};
+
+#endif  // SAMCPP__SAM_STREAM_H_
@@ -0,0 +1,173 @@
+#include "tiledSam.h"
+#include <algorithm>
+
+TiledSam::TiledSam(Sam& sam) : m_sam(sam), m_context(sam) {}
+TiledSam::TiledSam(Sam& sam, const Parameter& param) : m_sam(sam), m_param(param), m_context(sam) {}
+TiledSam::~TiledSam() = default;
+
+// Tile offsets along one axis, stride apart; the last tile ends at the image border
+static std::vector<int> tileOffsets(int length, int tileSize, int stride) {
+    std::vector<int> offsets{0};
+    while (offsets.back() + tileSize < length) {
+        offsets.push_back(std::min(offsets.back() + stride, length - tileSize));
+    }
+    return offsets;
+}
+
+bool TiledSam::setImage(const cv::Mat& image) {
+    m_tiles.clear();
+    m_embeddings.clear();
+    m_columns = 0;
+    m_image.release();
+    if (image.empty() || image.type() != CV_8UC3) return false;
+
+    const cv::Size inputSize = m_sam.getInputSize();
+    const int tileSize =
+        m_param.tileSize > 0 ? m_param.tileSize : std::max(inputSize.width, inputSize.height);
+    if (tileSize <= 0) return false;
+    const int stride = std::max(tileSize - std::max(m_param.overlap, 0), 1);
+
+    const auto xs = tileOffsets(image.cols, tileSize, stride);
+    const auto ys = tileOffsets(image.rows, tileSize, stride);
+    for (int y : ys) {
+        for (int x : xs) {
+            m_tiles.push_back(
+                cv::Rect(x, y, std::min(tileSize, image.cols), std::min(tileSize, image.rows)));
+        }
+    }
+    m_columns = (int)xs.size();
+    m_embeddings.resize(m_tiles.size());
+    m_image = image;
+    m_context.reset();
+    return true;
+}
+
+size_t TiledSam::encodedTiles() const {
+    return std::count_if(m_embeddings.begin(), m_embeddings.end(),
+                         [](const Sam::EmbeddingHandle& e) { return e != nullptr; });
+}
+
+bool TiledSam::encode(const std::vector<size_t>& tiles) {
+    std::vector<size_t> missing;
+    std::vector<cv::Mat> images;
+    for (size_t i : tiles) {
+        if (m_embeddings[i]) continue;
+        missing.push_back(i);
+        images.push_back(m_image(m_tiles[i]));
+    }
+    if (missing.empty()) return true;
+
+    auto embeddings = m_sam.encodeBatch(images);
+    bool ok = embeddings.size() == missing.size();
+    for (size_t k = 0; k < missing.size() && k < embeddings.size(); k++) {
+        ok = ok && embeddings[k] != nullptr;
+        m_embeddings[missing[k]] = std::move(embeddings[k]);
+    }
+    return ok;
+}
+
+bool TiledSam::prefetch(const cv::Rect& region) {
+    if (m_tiles.empty()) return false;
+    std::vector<size_t> tiles;
+    for (size_t i = 0; i < m_tiles.size(); i++) {
+        if (region.empty() || !(m_tiles[i] & region).empty()) tiles.push_back(i);
+    }
+    return encode(tiles);
+}
+
+// Part of the tile its mask is taken from: the overlaps with decoded neighbours in its row or
+// column are split in the middle. Overlaps with only a diagonal neighbour decoded are shared.
+cv::Rect TiledSam::ownedRegion(size_t tile, const std::vector<bool>& decoded) const {
+    const cv::Rect& rect = m_tiles[tile];
+    const size_t columns = (size_t)m_columns;
+    const size_t column = tile % columns;
+    int x0 = rect.x, y0 = rect.y, x1 = rect.br().x, y1 = rect.br().y;
+    if (column > 0 && decoded[tile - 1]) x0 = (rect.x + m_tiles[tile - 1].br().x) / 2;
+    if (column + 1 < columns && decoded[tile + 1]) x1 = (m_tiles[tile + 1].x + rect.br().x) / 2;
+    if (tile >= columns && decoded[tile - columns]) {
+        y0 = (rect.y + m_tiles[tile - columns].br().y) / 2;
+    }
+    if (tile + columns < m_tiles.size() && decoded[tile + columns]) {
+        y1 = (m_tiles[tile + columns].y + rect.br().y) / 2;
+    }
+    return cv::Rect(cv::Point(x0, y0), cv::Point(x1, y1));
+}
+
+bool TiledSam::getMask(const Sam::Prompt& prompt, cv::Mat& mask, double* iou, cv::Rect* box) {
+    if (m_tiles.empty()) return false;
+
+    // the tiles the prompt touches and their part of it, in tile coordinates
+    std::vector<size_t> touched;
+    std::vector<Sam::Prompt> tilePrompts;
+    for (size_t i = 0; i < m_tiles.size(); i++) {
+        const cv::Rect& rect = m_tiles[i];
+        auto inside = [&rect](const std::list<cv::Point>& points, std::list<cv::Point>& out) {
+            for (const auto& p : points) {
+                if (rect.contains(p)) out.push_back(p - rect.tl());
+            }
+        };
+        Sam::Prompt local;
+        inside(prompt.points, local.points);
+        const cv::Rect roi = prompt.roi & rect;
+        if (local.points.empty() && roi.empty()) continue;
+        inside(prompt.negativePoints, local.negativePoints);
+        if (!roi.empty()) local.roi = roi - rect.tl();
+        touched.push_back(i);
+        tilePrompts.push_back(std::move(local));
+    }
+    if (touched.empty() || !encode(touched)) return false;
+
+    Sam::MaskOptions options;
+    options.output = Sam::MaskOutput::MaskCropped;
+    options.threshold = m_param.threshold;
+    options.bestCandidate = m_param.bestCandidate;
+    if (m_tileMasks.size() < touched.size()) {
+        m_tileMasks.resize(touched.size());
+        m_tileBoxes.resize(touched.size());
+    }
+    std::vector<double> tileIous(touched.size());
+    std::vector<bool> decoded(m_tiles.size(), false);
+    for (size_t j = 0; j < touched.size(); j++) {
+        const size_t i = touched[j];
+        if (!m_sam.getMask(m_context, m_embeddings[i], tilePrompts[j], options, m_tileMasks[j],
+                           &tileIous[j], &m_tileBoxes[j])) {
+            return false;
+        }
+        decoded[i] = true;
+    }
+
+    // the part of every tile mask that goes into the result, in image coordinates
+    std::vector<cv::Rect> parts(touched.size());
+    std::vector<cv::Point> origins(touched.size());  // of the tile masks
+    cv::Rect maskBox;
+    int bestArea = -1;
+    double bestIou = 0;
+    for (size_t j = 0; j < touched.size(); j++) {
+        origins[j] = m_tileBoxes[j].tl() + m_tiles[touched[j]].tl();
+        parts[j] = cv::Rect(origins[j], m_tileBoxes[j].size()) & ownedRegion(touched[j], decoded);
+        if (parts[j].empty()) continue;
+        maskBox |= parts[j];
+        const int area = cv::countNonZero(m_tileMasks[j](parts[j] - origins[j]));
+        if (area > bestArea) {
+            bestArea = area;
+            bestIou = tileIous[j];
+        }
+    }
+
+    const cv::Point origin = m_param.cropToMask ? maskBox.tl() : cv::Point();
+    const cv::Size size = m_param.cropToMask ? maskBox.size() : m_image.size();
+    if (size.empty()) {
+        mask.release();
+    } else {
+        mask.create(size, CV_8UC1);
+        mask.setTo(0);
+    }
+    for (size_t j = 0; j < touched.size(); j++) {
+        if (parts[j].empty()) continue;
+        cv::Mat target = mask(parts[j] - origin);
+        cv::bitwise_or(target, m_tileMasks[j](parts[j] - origins[j]), target);
+    }
+    if (iou != nullptr) *iou = bestIou;
+    if (box != nullptr) *box = maskBox;
+    return true;
+}
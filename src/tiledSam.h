@@ -0,0 +1,66 @@
+#ifndef SAMCPP__TILED_SAM_H_
+#define SAMCPP__TILED_SAM_H_
+
+#include <vector>
+#include "edgeSam.h"
+
+// High resolution images (aerial, pathology): instead of downscaling the whole image to the
+// encoder input, it is split into overlapping tiles of the encoder input size, each encoded at
+// full resolution. Tiles are encoded lazily, when a prompt first touches them or by prefetch,
+// all the tiles one call needs in a single encodeBatch. A prompt is decoded on every tile it
+// touches and the tile masks are stitched: where decoded tiles of one row or column overlap,
+// each takes the half of the overlap on its side. One instance per image, its methods are not
+// meant to be called concurrently.
+class TiledSam {
+public:
+    struct Parameter {
+        int tileSize{0};  // side of the square tiles in source pixels, 0 - the encoder input size
+        // pixels shared by neighbouring tiles; objects up to about this size crossing a tile
+        // border lie whole in one tile
+        int overlap{256};
+        float threshold{0.f};  // logit threshold of the tile masks
+        bool bestCandidate{false};
+        // masks only cover their bounding box, like MaskOutput::MaskCropped, instead of the
+        // whole image; encodeRle(mask, box, size) turns them into full image RLE
+        bool cropToMask{false};
+    };
+
+    TiledSam(Sam& sam);
+    TiledSam(Sam& sam, const Parameter& param);
+    ~TiledSam();
+    TiledSam(const TiledSam&) = delete;
+    TiledSam& operator=(const TiledSam&) = delete;
+
+    // Splits image into tiles and forgets the embeddings of the previous one; nothing is encoded
+    // yet. The image is not copied, it must stay valid and unchanged until the next setImage.
+    bool setImage(const cv::Mat& image);
+    // tile rectangles in image coordinates, row by row
+    const std::vector<cv::Rect>& tiles() const { return m_tiles; }
+    size_t encodedTiles() const;
+    // Encodes the tiles overlapping region (the whole image when empty) not encoded yet
+    bool prefetch(const cv::Rect& region = cv::Rect());
+
+    // Decodes prompt (image coordinates) on the tiles it touches: those holding one of its
+    // points or overlapping its roi, each getting the part of the prompt inside it. mask is
+    // CV_8UC1 0 / 255 of the image size, or of box with cropToMask. box receives the bounding
+    // box of the mask, iou the predicted IoU of the tile contributing most of it.
+    bool getMask(const Sam::Prompt& prompt, cv::Mat& mask, double* iou = nullptr,
+                 cv::Rect* box = nullptr);
+
+private:
+    Sam& m_sam;
+    Parameter m_param;
+    Sam::DecodeContext m_context;
+    cv::Mat m_image;
+    std::vector<cv::Rect> m_tiles;
+    int m_columns{0};
+    std::vector<Sam::EmbeddingHandle> m_embeddings;  // per tile, null until encoded
+    // per tile decode buffers of getMask, reused between calls
+    std::vector<cv::Mat> m_tileMasks;
+    std::vector<cv::Rect> m_tileBoxes;
+
+    bool encode(const std::vector<size_t>& tiles);
+    cv::Rect ownedRegion(size_t tile, const std::vector<bool>& decoded) const;
+};
+
+#endif  // SAMCPP__TILED_SAM_H_
@@ -0,0 +1,41 @@
+#include "workQueue.h"
+#include <algorithm>
+
+WorkQueue::WorkQueue(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {
+    m_worker = std::thread(&WorkQueue::run, this);
+}
+
+WorkQueue::~WorkQueue() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_notEmpty.notify_all();
+    m_worker.join();
+}
+
+void WorkQueue::push(std::function<void()> job) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this] { return m_jobs.size() < m_capacity; });
+    m_jobs.push_back(std::move(job));
+    lock.unlock();
+    m_notEmpty.notify_one();
+}
+
+size_t WorkQueue::pending() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+void WorkQueue::run() {
+    for (;;) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty()) return;
+        auto job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        job();
+    }
+}
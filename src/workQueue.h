@@ -0,0 +1,33 @@
+#ifndef SAMCPP__WORK_QUEUE_H_
+#define SAMCPP__WORK_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Single worker thread running jobs in submission order. At most capacity jobs wait in the
+// queue, push() blocks while it is full so producers cannot run ahead of the worker.
+class WorkQueue {
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty, m_notFull;
+    std::thread m_worker;
+    size_t m_capacity;
+    bool m_stop{false};
+
+    void run();
+
+public:
+    explicit WorkQueue(size_t capacity);
+    // runs the jobs still queued, then joins the worker
+    ~WorkQueue();
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    void push(std::function<void()> job);
+    size_t pending();
+};
+
+#endif  // SAMCPP__WORK_QUEUE_H_
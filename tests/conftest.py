@@ -13,6 +13,39 @@ if TYPE_CHECKING:
     from numpy.typing import NDArray
 
 
+def pytest_addoption(parser: pytest.Parser) -> None:
+    """Add the options recording and requiring performance baselines."""
+    parser.addoption(
+        "--update-baseline",
+        action="store_true",
+        default=False,
+        help="record benchmark results in tests/perf_baseline.json instead of comparing",
+    )
+    parser.addoption(
+        "--require-baseline",
+        action="store_true",
+        default=False,
+        help="fail benchmarks without a stored baseline instead of skipping them (set in CI)",
+    )
+
+
+def pytest_collection_modifyitems(config: pytest.Config, items: list[pytest.Item]) -> None:
+    """Skip benchmark tests unless they are selected with ``-m benchmark``.
+
+    Args:
+        config: Pytest configuration.
+        items: Collected test items.
+    """
+    if "benchmark" in (config.getoption("markexpr") or "") or config.getoption(
+        "--update-baseline",
+    ):
+        return
+    skip = pytest.mark.skip(reason="benchmark, run with -m benchmark")
+    for item in items:
+        if "benchmark" in item.keywords:
+            item.add_marker(skip)
+
+
 @pytest.fixture
 def sample_image() -> NDArray[np.uint8]:
     """Create a sample test image.
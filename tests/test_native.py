@@ -0,0 +1,126 @@
+"""Tests for the C++ engine bindings."""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING
+
+import numpy as np
+import pytest
+
+
+if TYPE_CHECKING:
+    from pathlib import Path
+
+    from numpy.typing import NDArray
+
+
+pytest.importorskip("edgesam_py._edgesam")
+
+from edgesam_py.native import NativeSegmenter, _split_prompt  # noqa: E402
+
+
+@pytest.fixture
+def segmenter(encoder_path: Path, decoder_path: Path) -> NativeSegmenter:
+    """Create a native segmenter, skipping when the models are missing."""
+    if not encoder_path.exists() or not decoder_path.exists():
+        pytest.skip("Model files not found")
+    return NativeSegmenter(encoder_path, decoder_path, collect_metrics=True)
+
+
+class TestNativeSegmenter:
+    """Tests for NativeSegmenter."""
+
+    def test_split_prompt(self) -> None:
+        """SAM labels map to positive / negative points and box corners."""
+        coords = np.array([[1, 2], [3, 4], [5, 6], [7, 8], [9, 9]], dtype=np.float32)
+        labels = np.array([1, 0, 2, 3, -1], dtype=np.float32)
+        positive, negative, box = _split_prompt(coords, labels)
+        assert [tuple(p) for p in positive] == [(1, 2)]
+        assert [tuple(p) for p in negative] == [(3, 4)]
+        assert box == (5, 6, 7, 8)
+
+    def test_model_family(self, segmenter: NativeSegmenter) -> None:
+        """The EdgeSAM decoder is recognized from its input / output names."""
+        assert segmenter.sam.model_family == "edgesam"
+
+    def test_predict_shape(
+        self,
+        segmenter: NativeSegmenter,
+        sample_image: NDArray[np.uint8],
+    ) -> None:
+        """Masks come back at the image size as float32 probabilities."""
+        segmenter.set_image(sample_image)
+        mask, iou = segmenter.predict(np.array([[128, 128]], dtype=np.float32))
+        assert mask.shape == sample_image.shape[:2]
+        assert mask.dtype == np.float32
+        assert 0.0 <= mask.min() <= mask.max() <= 1.0
+        assert isinstance(iou, float)
+
+    def test_embedding_reuse(
+        self,
+        segmenter: NativeSegmenter,
+        sample_image: NDArray[np.uint8],
+    ) -> None:
+        """Several prompts decode on one embedding without encoding again."""
+        segmenter.sam.reset_metrics()
+        embedding = segmenter.set_image(sample_image)
+        for x in (64, 128, 192):
+            segmenter.predict(np.array([[x, x]], dtype=np.float32), embedding=embedding)
+        metrics = segmenter.sam.metrics()
+        assert metrics["stages"]["encoder_run"]["count"] == 1
+        assert metrics["stages"]["decoder_run"]["count"] == 3  # noqa: PLR2004
+
+    @pytest.mark.parametrize("shape", [(1, 3000, 3), (3000, 1, 3)])
+    def test_thin_image(self, segmenter: NativeSegmenter, shape: tuple[int, int, int]) -> None:
+        """Images whose short side scales below one input pixel still encode and decode."""
+        image = np.full(shape, 128, dtype=np.uint8)
+        embedding = segmenter.sam.encode(image)
+        assert embedding.source_size == (shape[1], shape[0])
+        mask, _, _ = segmenter.sam.get_mask(points=[(0, 0)], embedding=embedding)
+        assert mask.shape == shape[:2]
+
+    def test_zero_copy(
+        self,
+        segmenter: NativeSegmenter,
+        sample_image: NDArray[np.uint8],
+    ) -> None:
+        """Masks and embedding values are views over the C++ buffers."""
+        embedding = segmenter.set_image(sample_image)
+        mask, _, _ = segmenter.sam.get_mask(points=[(128, 128)], embedding=embedding)
+        assert mask.dtype == np.uint8
+        assert not mask.flags.owndata
+        values = embedding.values
+        assert not values.flags.owndata
+        assert not values.flags.writeable
+        assert list(values.shape) == list(embedding.shape)
+
+    @pytest.mark.parametrize(("storage", "tolerance"), [("float16", 1e-2), ("int8", 5e-2)])
+    def test_compressed_storage(
+        self,
+        segmenter: NativeSegmenter,
+        encoder_path: Path,
+        decoder_path: Path,
+        sample_image: NDArray[np.uint8],
+        tmp_path: Path,
+        storage: str,
+        tolerance: float,
+    ) -> None:
+        """Compressed embeddings stay close to float32 and save smaller files."""
+        reference = segmenter.set_image(sample_image)
+        compressed = NativeSegmenter(encoder_path, decoder_path, embedding_storage=storage)
+        embedding = compressed.set_image(sample_image)
+        assert embedding.storage == storage
+        scale = np.abs(reference.values).max()
+        assert np.abs(embedding.values - reference.values).max() <= tolerance * scale
+
+        mask, _, _ = compressed.sam.get_mask(points=[(128, 128)], embedding=embedding)
+        expected, _, _ = segmenter.sam.get_mask(points=[(128, 128)], embedding=reference)
+        assert np.mean(mask != expected) < 0.01  # noqa: PLR2004
+
+        path = tmp_path / "embedding.bin"
+        compressed.sam.save_embedding(embedding, str(path))
+        segmenter.sam.save_embedding(reference, str(path.with_suffix(".fp32")))
+        assert path.stat().st_size < path.with_suffix(".fp32").stat().st_size
+        loaded = compressed.sam.load_embedding(str(path))
+        assert loaded.storage == storage
+        assert np.array_equal(loaded.values, embedding.values)
@@ -0,0 +1,285 @@
+"""Performance regression tests of the Python and C++ engines.
+
+Both engines run the same fixed image set with every shipped model pair, each in a fresh
+process so peak RSS is its own. Masks of the two engines must agree, and encoder / decoder
+latency, peak RSS and C++ allocations per decode are compared against tests/perf_baseline.json:
+a change fails when it is slower or uses more memory than the stored value plus its threshold.
+Baselines depend on the machine, record them with ``make benchmark-baseline``. A missing
+baseline skips the comparison locally and fails it in CI (``CI`` set) or with
+``--require-baseline``.
+"""
+
+from __future__ import annotations
+
+import json
+import multiprocessing
+import os
+import statistics
+import sys
+import time
+from concurrent.futures import ProcessPoolExecutor
+from pathlib import Path
+from typing import TYPE_CHECKING, Any, Callable
+
+import cv2
+import numpy as np
+import pytest
+
+
+if TYPE_CHECKING:
+    from collections.abc import Iterator
+
+    from numpy.typing import NDArray
+
+
+resource = pytest.importorskip("resource")  # peak RSS, POSIX only
+
+pytestmark = pytest.mark.benchmark
+
+MODELS_DIR = Path(__file__).parent.parent / "models"
+BASELINE_PATH = Path(__file__).parent / "perf_baseline.json"
+ENGINES = ("python", "native")
+MODEL_PAIRS = ("edge_sam", "edge_sam_3x")
+REPEATS = 5
+
+
+def _model_paths(pair: str) -> tuple[Path, Path]:
+    """Return the encoder and decoder of a model pair."""
+    return MODELS_DIR / f"{pair}_encoder.onnx", MODELS_DIR / f"{pair}_decoder.onnx"
+
+
+def _images() -> list[tuple[NDArray[np.uint8], list[tuple[int, int]]]]:
+    """Return the fixed image set: images of filled shapes and a point on each shape.
+
+    Two square images (downscaled and unscaled) and a non-square one, which is letterboxed with
+    bottom / right padding.
+    """
+    rng = np.random.default_rng(0)
+    images = []
+    for height, width in ((1024, 1024), (512, 512), (600, 900)):
+        rows = np.linspace(40, 200, height, dtype=np.float32)
+        cols = np.linspace(40, 200, width, dtype=np.float32)
+        image = np.repeat(np.add.outer(rows, cols)[..., None] / 2, 3, axis=2)
+        image = (image + rng.normal(0, 4, image.shape)).clip(0, 255).astype(np.uint8)
+        short = min(height, width)
+        points = []
+        for _ in range(3):
+            x = int(rng.integers(width // 5, width * 4 // 5))
+            y = int(rng.integers(height // 5, height * 4 // 5))
+            radius = int(rng.integers(short // 16, short // 8))
+            color = tuple(int(c) for c in rng.integers(0, 255, 3))
+            cv2.circle(image, (x, y), radius, color, -1)
+            points.append((x, y))
+        images.append((image, points))
+    return images
+
+
+def _resized_size(shape: tuple[int, int], size: int = 1024) -> tuple[tuple[int, int], float]:
+    """Return the (width, height) and scale of an image letterboxed into a size x size input."""
+    height, width = shape
+    scale = size / max(height, width)
+    return (min(round(width * scale), size), min(round(height * scale), size)), scale
+
+
+def _letterbox(image: NDArray[np.uint8], size: int = 1024) -> NDArray[np.uint8]:
+    """Letterbox an image into a size x size input the way the C++ engine does.
+
+    The image is scaled by size / its longer side, interpolated by area when shrinking, top left
+    aligned and zero padded.
+    """
+    resized_size, scale = _resized_size(image.shape[:2], size)
+    if resized_size != (image.shape[1], image.shape[0]):
+        interpolation = cv2.INTER_AREA if scale < 1 else cv2.INTER_LINEAR
+        image = cv2.resize(image, resized_size, interpolation=interpolation)
+    padded = np.zeros((size, size, 3), dtype=np.uint8)
+    padded[: image.shape[0], : image.shape[1]] = image
+    return padded
+
+
+def _native_runner(encoder: Path, decoder: Path) -> tuple[Callable, Callable, Callable]:
+    """Return encode, decode and allocation count functions of the C++ engine."""
+    from edgesam_py.native import NativeSegmenter
+
+    sam = NativeSegmenter(encoder, decoder, collect_metrics=True).sam
+
+    def encode(image: NDArray[np.uint8]) -> Any:
+        return sam.encode(np.ascontiguousarray(image))
+
+    def decode(embedding: Any, point: tuple[int, int], shape: tuple[int, int]) -> NDArray[np.bool_]:
+        mask, _, _ = sam.get_mask(points=[point], embedding=embedding)
+        return mask > 0
+
+    return encode, decode, lambda: sam.metrics()["allocations"]
+
+
+def _python_runner(encoder: Path, decoder: Path) -> tuple[Callable, Callable, None]:
+    """Return encode and decode functions of EdgeSAMSegmenter; it has no allocation count.
+
+    preprocess_image stretches images to the encoder input, so the reference letterboxes them
+    first like the C++ engine and crops the padding out of the low resolution masks.
+    """
+    from edgesam_py.segmentation import EdgeSAMSegmenter
+
+    segmenter = EdgeSAMSegmenter(encoder, decoder)
+    names = [inp.name for inp in segmenter.decoder_session.get_inputs()]
+
+    def encode(image: NDArray[np.uint8]) -> Any:
+        preprocessed, _ = segmenter.preprocess_image(_letterbox(image))
+        return segmenter.encode(preprocessed)
+
+    def decode(features: Any, point: tuple[int, int], shape: tuple[int, int]) -> NDArray[np.bool_]:
+        (resized_width, resized_height), scale = _resized_size(shape)
+        inputs = {
+            names[0]: features,
+            names[1]: np.array([[[point[0] * scale, point[1] * scale]]], dtype=np.float32),
+            names[2]: np.ones((1, 1), dtype=np.float32),
+        }
+        (masks,) = segmenter.decoder_session.run(["masks"], inputs)
+        low_res = masks[0, 0]
+        crop = low_res[
+            : max(round(resized_height * low_res.shape[0] / 1024), 1),
+            : max(round(resized_width * low_res.shape[1] / 1024), 1),
+        ]
+        return cv2.resize(crop, shape[::-1], interpolation=cv2.INTER_LINEAR) > 0
+
+    return encode, decode, None
+
+
+def _peak_rss_mb() -> float:
+    """Return the peak resident set size of this process in MB."""
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return peak / 2**20 if sys.platform == "darwin" else peak / 2**10
+
+
+def _measure(engine: str, pair: str, repeats: int) -> dict[str, Any]:
+    """Run the image set through one engine and model pair.
+
+    Returns:
+        Median encoder (image to embedding) and decoder (point to image size mask) latency in
+        milliseconds, peak RSS in MB, C++ allocations per decode (None for Python) and the
+        mask of every prompt.
+    """
+    runner = _native_runner if engine == "native" else _python_runner
+    encode, decode, allocations = runner(*_model_paths(pair))
+    images = _images()
+    decode(encode(images[0][0]), images[0][1][0], images[0][0].shape[:2])  # warm-up
+
+    encoder_ms, decoder_ms, masks = [], [], []
+    allocated = decodes = 0
+    for image, points in images:
+        for _ in range(repeats):
+            start = time.perf_counter()
+            embedding = encode(image)
+            encoder_ms.append((time.perf_counter() - start) * 1000)
+        before = allocations() if allocations else 0
+        for point in points:
+            for _ in range(repeats):
+                start = time.perf_counter()
+                mask = decode(embedding, point, image.shape[:2])
+                decoder_ms.append((time.perf_counter() - start) * 1000)
+                decodes += 1
+            masks.append(mask)
+        allocated += allocations() - before if allocations else 0
+    return {
+        "encoder_ms": statistics.median(encoder_ms),
+        "decoder_ms": statistics.median(decoder_ms),
+        "peak_rss_mb": _peak_rss_mb(),
+        "allocations": allocated / decodes if allocations else None,
+        "masks": masks,
+    }
+
+
+@pytest.fixture(scope="module")
+def measure() -> Callable[[str, str], dict[str, Any]]:
+    """Measure every engine and model pair once per module, each in a fresh process."""
+    from edgesam_py.native import native_available
+
+    results: dict[str, dict[str, Any]] = {}
+    context = multiprocessing.get_context("spawn")
+
+    def run(engine: str, pair: str) -> dict[str, Any]:
+        key = f"{engine}/{pair}"
+        if key not in results:
+            encoder, decoder = _model_paths(pair)
+            if not encoder.exists() or not decoder.exists():
+                pytest.skip("Model files not found")
+            if engine == "native" and not native_available():
+                pytest.skip("edgesam_py._edgesam is not built")
+            with ProcessPoolExecutor(max_workers=1, mp_context=context) as pool:
+                results[key] = pool.submit(_measure, engine, pair, REPEATS).result()
+        return results[key]
+
+    return run
+
+
+@pytest.fixture(scope="module")
+def baseline(request: pytest.FixtureRequest) -> Iterator[dict[str, Any]]:
+    """Load the stored baselines, written back with ``--update-baseline``."""
+    data = json.loads(BASELINE_PATH.read_text())
+    yield data
+    if request.config.getoption("--update-baseline"):
+        BASELINE_PATH.write_text(json.dumps(data, indent=2, sort_keys=True) + "\n")
+
+
+def _iou(a: NDArray[np.bool_], b: NDArray[np.bool_]) -> float:
+    """Return the intersection over union of two binary masks, 1 when both are empty."""
+    union = np.logical_or(a, b).sum()
+    return float(np.logical_and(a, b).sum() / union) if union else 1.0
+
+
+@pytest.mark.parametrize("pair", MODEL_PAIRS)
+def test_mask_parity(
+    measure: Callable[[str, str], dict[str, Any]],
+    baseline: dict[str, Any],
+    pair: str,
+) -> None:
+    """The C++ engine returns the masks of the Python one."""
+    expected = measure("python", pair)["masks"]
+    masks = measure("native", pair)["masks"]
+    assert len(masks) == len(expected)
+    for mask, reference in zip(masks, expected):
+        assert _iou(mask, reference) >= baseline["thresholds"]["mask_iou"]
+
+
+@pytest.mark.parametrize("pair", MODEL_PAIRS)
+@pytest.mark.parametrize("engine", ENGINES)
+def test_no_regression(
+    request: pytest.FixtureRequest,
+    measure: Callable[[str, str], dict[str, Any]],
+    baseline: dict[str, Any],
+    engine: str,
+    pair: str,
+) -> None:
+    """Latency, peak RSS and allocations stay within their thresholds of the baseline."""
+    key = f"{engine}/{pair}"
+    result = {
+        metric: value
+        for metric, value in measure(engine, pair).items()
+        if metric != "masks" and value is not None
+    }
+    if request.config.getoption("--update-baseline"):
+        baseline["results"][key] = result
+        return
+    stored = baseline["results"].get(key)
+    if stored is None:
+        message = f"No baseline for {key}, record one with `make benchmark-baseline`"
+        if os.environ.get("CI") or request.config.getoption("--require-baseline"):
+            pytest.fail(message)
+        pytest.skip(message)
+
+    thresholds = baseline["thresholds"]
+    # relative tolerance, plus an absolute one for allocations: the steady state is near 0
+    limits = {
+        "encoder_ms": (thresholds["latency"], 0.0),
+        "decoder_ms": (thresholds["latency"], 0.0),
+        "peak_rss_mb": (thresholds["memory"], 0.0),
+        "allocations": (thresholds["allocations"], thresholds["allocations_absolute"]),
+    }
+    regressions = [
+        f"{metric} {result[metric]:.2f} > {stored[metric]:.2f} + {relative:.0%} + {absolute:g}"
+        for metric, (relative, absolute) in limits.items()
+        if metric in result
+        and metric in stored
+        and result[metric] > stored[metric] * (1 + relative) + absolute
+    ]
+    assert not regressions, f"{key} regressed: {', '.join(regressions)}"
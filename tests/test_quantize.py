@@ -0,0 +1,189 @@
+"""Tests for the model quantization tool."""
+
+from __future__ import annotations
+
+from typing import TYPE_CHECKING
+
+import numpy as np
+import pytest
+
+
+if TYPE_CHECKING:
+    from pathlib import Path
+
+
+onnx = pytest.importorskip("onnx")
+ort = pytest.importorskip("onnxruntime")
+
+
+def _make_model(path: Path) -> Path:
+    """Write a small float32 conv model with one input and one output."""
+    from onnx import TensorProto, helper, numpy_helper
+
+    rng = np.random.default_rng(0)
+    weight = numpy_helper.from_array(rng.standard_normal((4, 3, 3, 3)).astype(np.float32), "w")
+    node = helper.make_node("Conv", ["image", "w"], ["image_embeddings"], pads=[1, 1, 1, 1])
+    graph = helper.make_graph(
+        [node],
+        "tiny",
+        [helper.make_tensor_value_info("image", TensorProto.FLOAT, [1, 3, 16, 16])],
+        [helper.make_tensor_value_info("image_embeddings", TensorProto.FLOAT, [1, 4, 16, 16])],
+        [weight],
+    )
+    model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 13)])
+    onnx.save(model, str(path))
+    return path
+
+
+def _run(path: Path, image: np.ndarray) -> np.ndarray:
+    """Run a single-input model on the CPU and return its first output."""
+    session = ort.InferenceSession(str(path), providers=["CPUExecutionProvider"])
+    return session.run(None, {"image": image})[0]
+
+
+class TestQuantize:
+    """Tests for fp16 / int8 model variants."""
+
+    def test_fp16_changes_io_types(self, tmp_path: Path) -> None:
+        """fp16 conversion without keep_io_types yields fp16 inputs and outputs."""
+        pytest.importorskip("onnxconverter_common")
+        from edgesam_py.quantize import convert_fp16
+
+        source = _make_model(tmp_path / "model.onnx")
+        converted = convert_fp16(source, tmp_path / "model_fp16.onnx")
+
+        session = ort.InferenceSession(str(converted), providers=["CPUExecutionProvider"])
+        assert session.get_inputs()[0].type == "tensor(float16)"
+        assert session.get_outputs()[0].type == "tensor(float16)"
+
+        image = np.random.default_rng(1).random((1, 3, 16, 16), dtype=np.float32)
+        reference = _run(source, image)
+        result = _run(converted, image.astype(np.float16)).astype(np.float32)
+        np.testing.assert_allclose(result, reference, atol=1e-2)
+
+    def test_int8_qdq_keeps_float_io(self, tmp_path: Path) -> None:
+        """Static QDQ quantization keeps float inputs and outputs and stays close to fp32."""
+        pytest.importorskip("onnxruntime.quantization")
+        from edgesam_py.quantize import quantize_int8
+
+        rng = np.random.default_rng(2)
+        feeds = [{"image": rng.random((1, 3, 16, 16), dtype=np.float32)} for _ in range(8)]
+        source = _make_model(tmp_path / "model.onnx")
+        quantized = quantize_int8(source, tmp_path / "model_int8.onnx", feeds)
+
+        session = ort.InferenceSession(str(quantized), providers=["CPUExecutionProvider"])
+        assert session.get_inputs()[0].type == "tensor(float)"
+        assert session.get_outputs()[0].type == "tensor(float)"
+
+        image = feeds[0]["image"]
+        reference = _run(source, image)
+        result = _run(quantized, image)
+        assert np.abs(result - reference).max() < 0.1 * np.abs(reference).max()
+
+    def test_calibration_images_quantize_statically(
+        self,
+        tmp_path: Path,
+        monkeypatch: pytest.MonkeyPatch,
+    ) -> None:
+        """--calibration-images feeds preprocessed images to static QDQ quantization."""
+        pytest.importorskip("onnxruntime.quantization")
+        cv2 = pytest.importorskip("cv2")
+        from edgesam_py.quantize import image_feeds, main
+
+        rng = np.random.default_rng(3)
+        images = tmp_path / "images"
+        images.mkdir()
+        for i in range(4):
+            cv2.imwrite(str(images / f"{i}.png"), rng.integers(0, 255, (24, 32, 3), np.uint8))
+        source = _make_model(tmp_path / "model.onnx")
+
+        feeds = list(image_feeds(source, [images]))
+        assert len(feeds) == 4
+        assert feeds[0]["image"].shape == (1, 3, 16, 16)
+        assert feeds[0]["image"].dtype == np.float32
+        assert 0.0 <= feeds[0]["image"].min() <= feeds[0]["image"].max() <= 1.0
+
+        output = tmp_path / "model_int8.onnx"
+        monkeypatch.setattr(
+            "sys.argv",
+            [
+                "edgesam-quantize",
+                str(source),
+                str(output),
+                "--mode",
+                "int8",
+                "--calibration-images",
+                str(images),
+            ],
+        )
+        assert main() == 0
+
+        ops = {node.op_type for node in onnx.load(str(output)).graph.node}
+        assert "QuantizeLinear" in ops
+        assert "DequantizeLinear" in ops
+        session = ort.InferenceSession(str(output), providers=["CPUExecutionProvider"])
+        assert session.get_inputs()[0].type == "tensor(float)"
+
+    def test_calibration_images_require_int8(
+        self,
+        tmp_path: Path,
+        monkeypatch: pytest.MonkeyPatch,
+    ) -> None:
+        """--calibration-images is rejected outside int8 mode, int8 needs it or --dynamic."""
+        from edgesam_py.quantize import main
+
+        source = _make_model(tmp_path / "model.onnx")
+        monkeypatch.setattr(
+            "sys.argv",
+            [
+                "edgesam-quantize",
+                str(source),
+                str(tmp_path / "out.onnx"),
+                "--calibration-images",
+                str(tmp_path),
+            ],
+        )
+        with pytest.raises(SystemExit):
+            main()
+
+        monkeypatch.setattr(
+            "sys.argv",
+            ["edgesam-quantize", str(source), str(tmp_path / "out.onnx"), "--mode", "int8"],
+        )
+        with pytest.raises(SystemExit):
+            main()
+
+    def test_int8_requires_calibration_or_dynamic(self, tmp_path: Path) -> None:
+        """Dynamic quantization is opt-in, int8 without calibration feeds is rejected."""
+        pytest.importorskip("onnxruntime.quantization")
+        from edgesam_py.quantize import quantize_int8
+
+        source = _make_model(tmp_path / "model.onnx")
+        with pytest.raises(ValueError, match="calibration feeds"):
+            quantize_int8(source, tmp_path / "model_int8.onnx")
+
+        quantized = quantize_int8(source, tmp_path / "model_int8.onnx", dynamic=True)
+        ops = {node.op_type for node in onnx.load(str(quantized)).graph.node}
+        assert "QuantizeLinear" not in ops
+
+    def test_calibration_images_reject_decoders(self, tmp_path: Path) -> None:
+        """Models with several inputs (decoders) cannot be calibrated from images."""
+        from onnx import TensorProto, helper
+
+        from edgesam_py.quantize import image_feeds
+
+        node = helper.make_node("Add", ["image_embeddings", "point_coords"], ["masks"])
+        graph = helper.make_graph(
+            [node],
+            "decoder",
+            [
+                helper.make_tensor_value_info("image_embeddings", TensorProto.FLOAT, [1, 4]),
+                helper.make_tensor_value_info("point_coords", TensorProto.FLOAT, [1, 4]),
+            ],
+            [helper.make_tensor_value_info("masks", TensorProto.FLOAT, [1, 4])],
+        )
+        path = tmp_path / "decoder.onnx"
+        onnx.save(helper.make_model(graph), str(path))
+
+        with pytest.raises(ValueError, match="2 inputs"):
+            next(image_feeds(path, [tmp_path]))
@@ -124,6 +124,40 @@ class TestEdgeSAMSegmenter:
         assert "encoder" in repr_str
         assert "decoder" in repr_str
 
+    def test_save_result_matches_blend(
+        self,
+        encoder_path: Path,
+        decoder_path: Path,
+        sample_image: NDArray[np.uint8],
+        tmp_path: Path,
+    ) -> None:
+        """save_result blends the masked pixels with green like cv2.addWeighted.
+
+        Args:
+            encoder_path: Encoder path fixture.
+            decoder_path: Decoder path fixture.
+            sample_image: Sample image fixture.
+            tmp_path: Temporary directory.
+        """
+        if not encoder_path.exists() or not decoder_path.exists():
+            pytest.skip("Model files not found")
+
+        segmenter = EdgeSAMSegmenter(
+            encoder_path=encoder_path,
+            decoder_path=decoder_path,
+        )
+        mask = np.zeros(sample_image.shape[:2], dtype=np.float32)
+        mask[64:192, 32:128] = 1.0
+
+        output_path = tmp_path / "result.png"
+        segmenter.save_result(sample_image, mask, output_path)
+
+        overlay = sample_image.copy()
+        overlay[mask > 0.5] = [0, 255, 0]
+        expected = cv2.addWeighted(sample_image, 0.7, overlay, 0.3, 0)
+        result = cv2.imread(str(output_path))
+        assert np.abs(result.astype(np.int16) - expected.astype(np.int16)).max() <= 1
+
 
 @pytest.mark.slow
 @pytest.mark.integration